@@ -18,6 +18,7 @@ HEADERS += \
      App/Mode.h  \
      App/RecentBooks.h  \
      App/SceneBank.h  \
+     App/StartupProfile.h  \
      App/Translate.h  \
      App/UserInfo.h  \
      App/Version.h  \
@@ -42,6 +43,7 @@ SOURCES += \
      App/Printing.cpp  \
      App/RecentBooks.cpp  \
      App/SceneBank.cpp  \
+     App/StartupProfile.cpp  \
      App/Translate.cpp  \
      App/UserInfo.cpp  \
      App/Version.cpp  \
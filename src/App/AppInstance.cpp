@@ -12,6 +12,7 @@
 #include "BackgroundVC.h"
 #include "Assert.h"
 #include "Style.h"
+#include "StartupProfile.h"
 
 #include <QTimer>
 #include <QDebug>
@@ -27,21 +28,32 @@ AppInstance::AppInstance(App *app, Notebook *nb): book(nb) {
   backgroundVC = 0;
 
   qDebug() << "AppInstance: seting up VC";
-  setupVC();
+  { StartupProfile::Phase p("version control");
+    setupVC();
+  }
   qDebug() << "VC setup complete";
 
-  book->load();
+  { StartupProfile::Phase p("notebook");
+    book->load();
+  }
 
   connect(app, SIGNAL(aboutToQuit()), this, SLOT(commitNow()));
 
-  bank = new SceneBank(nb);
+  { StartupProfile::Phase p("scene bank");
+    bank = new SceneBank(nb);
+  }
 
-  PageEditor *editor = new PageEditor(bank);
-  editor->resize(DefaultSize::onScreenSize(editor->sizeHint()));
-  editor->show();
+  PageEditor *editor;
+  { StartupProfile::Phase p("first page view");
+    editor = new PageEditor(bank);
+    editor->resize(DefaultSize::onScreenSize(editor->sizeHint()));
+    editor->show();
+  }
   registerEditor(editor);
 
   aopen = new AlreadyOpen(nb->dirPath(), editor);
+
+  StartupProfile::report();
 }
 
 AppInstance::~AppInstance() {
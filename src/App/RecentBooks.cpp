@@ -19,6 +19,7 @@
 #include "RecentBooks.h"
 #include "Notebook.h"
 #include "BookFile.h"
+#include "DataLoader.h"
 #include <QSettings>
 #include "Assert.h"
 
@@ -38,15 +39,14 @@ BookInfo::BookInfo(QString d) {
   dirname = d;
   QDir root(dirname);
   QString bookfile = root.exists("book.eln") ? "book.eln" : "book.json";    
-  BookFile *bf = BookFile::load(root.filePath(bookfile));
-  if (bf) {
-    BookData const *bd = bf->data();
-    title = bd->title();
-    author = bd->author();
-    address = bd->address();
-    created = bd->created();
-    modified = bd->modified();
-    delete bf;
+  bool ok;
+  QVariantMap hdr = DataLoader::readHeader(root.filePath(bookfile), &ok);
+  if (ok) {
+    title = hdr["title"].toString();
+    author = hdr["author"].toString();
+    address = hdr["address"].toString();
+    created = hdr["cre"].toDateTime();
+    modified = hdr["mod"].toDateTime();
   }
 }
 
@@ -0,0 +1,164 @@
+// App/StartupProfile.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// StartupProfile.C
+
+#include "StartupProfile.h"
+#include "JSONFile.h"
+#include "Version.h"
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QFile>
+#include <QDebug>
+
+namespace {
+  struct Record {
+    QString name;
+    int depth;
+    qint64 startNs;
+    qint64 ns;
+    int startFiles;
+    int files;
+    qint64 startBytes;
+    qint64 bytes;
+  };
+
+  struct State {
+    State(): depth(0), files(0), bytes(0), reported(false) { }
+    QElapsedTimer clock;
+    QList<Record> records;
+    int depth;
+    int files;
+    qint64 bytes;
+    QString jsonfn;
+    bool reported;
+    QMutex mutex; // only for files and bytes; phases are GUI-thread only
+  };
+
+  State &state() {
+    static State s;
+    return s;
+  }
+};
+
+bool StartupProfile::enabled = false;
+
+void StartupProfile::enable(QString jsonfn) {
+  State &s = state();
+  if (!jsonfn.isEmpty())
+    s.jsonfn = jsonfn;
+  if (!enabled)
+    s.clock.start();
+  enabled = true;
+}
+
+void StartupProfile::countFile(qint64 bytes) {
+  if (!enabled)
+    return;
+  State &s = state();
+  QMutexLocker l(&s.mutex);
+  s.files ++;
+  s.bytes += bytes;
+}
+
+StartupProfile::Phase::Phase(char const *name) {
+  idx = -1;
+  if (!enabled)
+    return;
+  State &s = state();
+  if (s.reported)
+    return;
+  Record r;
+  r.name = name;
+  r.depth = s.depth++;
+  r.startNs = s.clock.nsecsElapsed();
+  r.ns = 0;
+  { QMutexLocker l(&s.mutex);
+    r.startFiles = s.files;
+    r.startBytes = s.bytes;
+  }
+  r.files = 0;
+  r.bytes = 0;
+  idx = s.records.size();
+  s.records << r;
+}
+
+StartupProfile::Phase::~Phase() {
+  if (idx<0)
+    return;
+  State &s = state();
+  Record &r = s.records[idx];
+  r.ns = s.clock.nsecsElapsed() - r.startNs;
+  { QMutexLocker l(&s.mutex);
+    r.files = s.files - r.startFiles;
+    r.bytes = s.bytes - r.startBytes;
+  }
+  s.depth--;
+}
+
+void StartupProfile::report() {
+  if (!enabled)
+    return;
+  State &s = state();
+  if (s.reported)
+    return;
+  s.reported = true;
+  qint64 totalNs = s.clock.nsecsElapsed();
+
+  qDebug() << "Startup profile:";
+  qDebug() << QString("  %1 %2 %3 %4")
+    .arg("phase", -32).arg("ms", 9).arg("files", 7).arg("kB", 9)
+    .toUtf8().constData();
+  QVariantList phases;
+  for (Record const &r: s.records) {
+    qDebug() << QString("  %1 %2 %3 %4")
+      .arg(QString(2*r.depth, ' ') + r.name, -32)
+      .arg(r.ns/1e6, 9, 'f', 1)
+      .arg(r.files, 7)
+      .arg(r.bytes/1024.0, 9, 'f', 1)
+      .toUtf8().constData();
+    QVariantMap p;
+    p["name"] = r.name;
+    p["depth"] = r.depth;
+    p["start_ms"] = r.startNs/1e6;
+    p["ms"] = r.ns/1e6;
+    p["files"] = r.files;
+    p["bytes"] = double(r.bytes);
+    phases << p;
+  }
+  qDebug() << QString("  %1 %2 %3 %4")
+    .arg("total", -32).arg(totalNs/1e6, 9, 'f', 1)
+    .arg(s.files, 7).arg(s.bytes/1024.0, 9, 'f', 1)
+    .toUtf8().constData();
+
+  QVariantMap top;
+  top["version"] = Version::toString();
+  top["date"] = QDateTime::currentDateTime();
+  top["total_ms"] = totalNs/1e6;
+  top["files"] = s.files;
+  top["bytes"] = double(s.bytes);
+  top["phases"] = phases;
+  if (s.jsonfn.isEmpty()) {
+    qDebug() << JSONFile::write(top, true).toUtf8().constData();
+  } else {
+    if (JSONFile::save(top, s.jsonfn))
+      qDebug() << "Startup profile written to" << s.jsonfn;
+    else
+      qDebug() << "StartupProfile: Failed to write" << s.jsonfn;
+  }
+}
@@ -0,0 +1,56 @@
+// App/StartupProfile.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// StartupProfile.H
+
+#ifndef STARTUPPROFILE_H
+
+#define STARTUPPROFILE_H
+
+#include <QString>
+
+class StartupProfile {
+  /* Optional timing of the phases of opening a notebook. Enabled by the
+     "-profile" command line flag or by setting ELN_PROFILE in the
+     environment. For each phase, we record wall time and the number of
+     files touched and bytes read. Phases may nest; the numbers for a
+     phase include those of its subphases.
+     At the end of startup, report() prints a table and a JSON version
+     of the same. If ELN_PROFILE names a file, the JSON goes there
+     instead, for tracking startup times across releases.
+     If not enabled, all of this costs next to nothing. */
+public:
+  class Phase {
+    // Times the phase from construction to destruction
+  public:
+    Phase(char const *name);
+    ~Phase();
+  private:
+    int idx;
+  };
+public:
+  static void enable(QString jsonfn="");
+  static bool isEnabled() { return enabled; }
+  static void countFile(qint64 bytes=0);
+  /* Called wherever startup touches a file. BYTES is the number of bytes
+     read, if any. Safe to call from any thread. */
+  static void report();
+  /* Only the first call does anything. */
+private:
+  static bool enabled;
+};
+
+#endif
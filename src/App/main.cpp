@@ -35,14 +35,24 @@
 #include "CrashReport.h"
 #include "VersionControl.h"
 #include "CUI.h"
+#include "StartupProfile.h"
+#include "BackgroundSaver.h"
 
 int main(int argc, char **argv) {
+  QString profile = QString::fromLocal8Bit(qgetenv("ELN_PROFILE"));
+  if (!profile.isEmpty())
+    StartupProfile::enable(profile=="1" ? "" : profile);
   CrashReport cr;
   Notebook *nb = 0;
   App app(argc, argv);
   try {
     app.setWindowIcon(QIcon(":/eln.png"));
     Fonts fonts;
+    if (argc>1 && QString("-profile")==argv[1]) {
+      StartupProfile::enable();
+      argc--;
+      argv++;
+    }
     if (argc>1 && QString("-novc")==argv[1]) {
       VersionControl::globallyDisable();
       argc--;
@@ -114,6 +124,7 @@ int main(int argc, char **argv) {
     delete inst;
 
     delete RecentBooks::instance();
+    BackgroundSaver::instance()->shutdown();
     return r;
   } catch (AssertedException) {
     return 1;
@@ -5,6 +5,9 @@ HEADERS += \
      Book/Catalog.h  \
      Book/Index.h  \
      Book/Notebook.h  \
+     Book/PageRangeIndex.h  \
+     Book/PhraseIndex.h  \
+     Book/PostingFile.h  \
      Book/Search.h  \
      Book/Style.h  \
      Book/TOCEntry.h  \
@@ -17,6 +20,9 @@ SOURCES += \
      Book/Catalog.cpp  \
      Book/Index.cpp  \
      Book/Notebook.cpp  \
+     Book/PageRangeIndex.cpp  \
+     Book/PhraseIndex.cpp  \
+     Book/PostingFile.cpp  \
      Book/Search.cpp  \
      Book/Style.cpp  \
      Book/TOC.cpp  \
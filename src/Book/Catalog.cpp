@@ -2,20 +2,43 @@
 
 #include "Catalog.h"
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QRegExp>
+#include <QDataStream>
+#include <QDebug>
+#include "PageCache.h"
+#include "StartupProfile.h"
 
-Catalog::Catalog(QString pgdir): pgdir(pgdir) {
+static quint32 const snapshotMagic = 0x454c4e53; // "ELNS"
+static quint32 const snapshotVersion = 1;
+
+Catalog::Catalog(QString pgdir, bool useSnapshot): pgdir(pgdir) {
+  if (useSnapshot && loadSnapshot())
+    statNotes();
+  else
+    scan();
+}
+
+void Catalog::scan() {
   ok = false;
+  pg2file.clear();
+  filemods.clear();
+  filesizes.clear();
+  notemods.clear();
+  err.clear();
   QDir pages(pgdir);
   if (!pages.exists())
     return;
+  // Take the time stamp first, so that changes during the scan are not lost
+  dirmod = QFileInfo(pgdir).lastModified();
 
   QRegExp re1("^(\\d\\d*)-([a-z0-9]+).json");
   QRegExp re0("^(\\d\\d*).json");
   QRegExp ren("^(\\d\\d*)-([a-z0-9]+).notes");
   
   foreach (QFileInfo const &fi, pages.entryInfoList()) {
+    StartupProfile::countFile();
     if (fi.isFile()) {
       QString fn = fi.fileName();
       if (fn.endsWith(".moved") || fn.endsWith(".THIS")
@@ -27,10 +50,12 @@ Catalog::Catalog(QString pgdir): pgdir(pgdir) {
         int n = re1.cap(1).toInt();
         pg2file.insert(n, fn);
         filemods[fn] = fi.lastModified();
+        filesizes[fn] = fi.size();
       } else if (re0.exactMatch(fn)) {
         int n = re0.cap(1).toInt();
         pg2file.insert(n, fn);
         filemods[fn] = fi.lastModified();
+        filesizes[fn] = fi.size();
       } else {
         err << "Cannot parse " + fn + " as a page file name.";
       }
@@ -43,7 +68,112 @@ Catalog::Catalog(QString pgdir): pgdir(pgdir) {
         notemods[fn] = fi.lastModified();
       }
     }
-  }  
+  }
+  ok = true;
+}
+
+Catalog::Changes Catalog::refresh() {
+  QMap<QString, QDateTime> oldmods = filemods;
+  QMap<QString, qint64> oldsizes = filesizes;
+  scan();
+  Changes c;
+  for (auto it=filemods.begin(); it!=filemods.end(); ++it) {
+    QString fn = it.key();
+    if (!oldmods.contains(fn))
+      c.added << fn;
+    else if (oldmods[fn]!=it.value() || oldsizes[fn]!=filesizes[fn])
+      c.modified << fn;
+  }
+  for (auto it=oldmods.begin(); it!=oldmods.end(); ++it)
+    if (!filemods.contains(it.key()))
+      c.removed << it.key();
+  return c;
+}
+
+bool Catalog::absorbWrite(QString fn, QDateTime mod, qint64 size,
+                          QDateTime dirBefore, QDateTime dirAfter) {
+  QFileInfo fi(fn);
+  if (fi.absolutePath()!=QFileInfo(pgdir).absoluteFilePath())
+    return false;
+  QString name = fi.fileName();
+  if (!filemods.contains(name) || dirBefore!=dirmod)
+    return false;
+  filemods[name] = mod;
+  filesizes[name] = size;
+  dirmod = dirAfter;
+  return true;
+}
+
+QString Catalog::snapshotFileName() const {
+  return PageCache::cacheFileName(QDir(pgdir).filePath("catalog"));
+}
+
+bool Catalog::loadSnapshot() {
+  QString fn = snapshotFileName();
+  if (fn.isEmpty())
+    return false;
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly))
+    return false;
+  QFileInfo di(pgdir);
+  if (!di.exists())
+    return false;
+  QDataStream s(&f);
+  s.setVersion(QDataStream::Qt_5_0);
+  quint32 m = 0, v = 0;
+  qint64 t = 0;
+  s >> m >> v >> t;
+  if (m!=snapshotMagic || v!=snapshotVersion
+      || t!=di.lastModified().toMSecsSinceEpoch())
+    return false;
+  s >> pg2file >> filemods >> filesizes >> notemods >> err;
+  StartupProfile::countFile(f.size());
+  if (s.status()!=QDataStream::Ok) {
+    pg2file.clear();
+    filemods.clear();
+    filesizes.clear();
+    notemods.clear();
+    err.clear();
+    return false;
+  }
+  dirmod = di.lastModified();
+  ok = true;
+  return true;
+}
+
+void Catalog::statNotes() {
+  /* Adding or removing a notes folder changes the modification time of
+     pgdir, but adding a note to an existing folder does not. */
+  QDir pages(pgdir);
+  for (auto it=notemods.begin(); it!=notemods.end(); ++it)
+    it.value() = QFileInfo(pages.filePath(it.key())).lastModified();
+}
+
+bool Catalog::saveSnapshot() const {
+  if (!ok)
+    return false;
+  QString fn = snapshotFileName();
+  if (fn.isEmpty())
+    return false;
+  QString tmpfn = fn + ".tmp";
+  QFile f(tmpfn);
+  if (!f.open(QFile::WriteOnly))
+    return false;
+  QDataStream s(&f);
+  s.setVersion(QDataStream::Qt_5_0);
+  s << snapshotMagic << snapshotVersion << dirmod.toMSecsSinceEpoch();
+  s << pg2file << filemods << filesizes << notemods << err;
+  bool good = s.status()==QDataStream::Ok;
+  f.close();
+  if (good) {
+    QFile::remove(fn);
+    good = QFile::rename(tmpfn, fn);
+  }
+  if (!good) {
+    QFile::remove(tmpfn);
+    qDebug() << "Catalog: Failed to save snapshot" << fn;
+  }
+  return good;
 }
 
 bool Catalog::isClean() const {
@@ -59,6 +189,10 @@ QDateTime Catalog::fileMod(QString fn) const {
   return filemods.contains(fn) ? filemods[fn] : QDateTime();
 }
 
+qint64 Catalog::fileSize(QString fn) const {
+  return filesizes.value(fn, -1);
+}
+
 bool Catalog::hasNotes(QString fn) const {
   return notemods.contains(fn);
 }
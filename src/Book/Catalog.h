@@ -13,19 +13,54 @@
 class Catalog {
   // Catalog of files in the pages/ folder
 public:
-  Catalog(QString pgdir);
+  struct Changes {
+    // Page files that differ between two scans
+    QStringList added;
+    QStringList modified;
+    QStringList removed;
+    bool isEmpty() const {
+      return added.isEmpty() && modified.isEmpty() && removed.isEmpty();
+    }
+  };
+public:
+  Catalog(QString pgdir, bool useSnapshot=false);
+  /* If USESNAPSHOT is true and a snapshot saved by saveSnapshot() is
+     available, the folder is not scanned unless its modification time
+     differs from that in the snapshot. Notes folders are always
+     restatted. */
   QString path() const { return pgdir; }
+  QDateTime dirMod() const { return dirmod; } // as of the last scan
   bool isValid() const { return ok; } // dir could be read
   bool isClean() const; // no errors and no duplicates
   QMultiMap<int, QString> const &pageToFileMap() const { return pg2file; }
   QDateTime fileMod(QString) const;
+  qint64 fileSize(QString) const;
   bool hasNotes(QString) const;
   QDateTime noteDirMod(QString) const;
   QStringList errors() const { return err; }
+  Changes refresh();
+  /* Rescans the folder and reports which page files have appeared,
+     disappeared, or changed since the last scan. */
+  bool absorbWrite(QString fn, QDateTime mod, qint64 size,
+                   QDateTime dirBefore, QDateTime dirAfter);
+  /* Records a write of our own to an existing page file, so that the
+     next refresh() need not find it. Nothing is recorded, and false is
+     returned, if the folder has changed in other ways since the last
+     scan; refresh() will then pick up everything. */
+  bool saveSnapshot() const;
+  /* Saves the catalog next to the page cache, if that is enabled.
+     Returns true if saved. */
+private:
+  void scan();
+  bool loadSnapshot();
+  void statNotes();
+  QString snapshotFileName() const;
 private:
   QString pgdir;
+  QDateTime dirmod; // of pgdir, as of the last scan
   QMultiMap<int, QString> pg2file;
   QMap<QString, QDateTime> filemods;
+  QMap<QString, qint64> filesizes;
   QMap<QString, QDateTime> notemods;
   bool ok;
   QStringList err;
@@ -18,37 +18,159 @@
 
 #include "Index.h"
 #include "WordIndex.h"
+#include "PhraseIndex.h"
+#include "EntryData.h"
+#include "TextData.h"
 #include "Assert.h"
 #include <QDebug>
 #include <QFile>
-#include <QTimer>
 #include <QSignalMapper>
 #include "EntryFile.h"
 #include "LateNoteManager.h"
+#include "SaveScheduler.h"
+#include <QPointer>
 
-#define INDEX_SAVEIVAL_S 5
+class WordTally {
+  /* Counts the words of an entry, late notes included, by adding up the
+     changes reported by each of its TextDatas. */
+public:
+  WordTally(int pgno): pgno(pgno) { }
+  void recount(QList<TextData *> const &texts,
+               QSet<QString> &added, QSet<QString> &removed);
+  /* Starts over from the full word counts of TEXTS. */
+  bool update(QList<TextData *> const &texts,
+              QSet<QString> &added, QSet<QString> &removed);
+  /* Collects the changes since the last call. Returns false, without
+     doing anything, if any of the TextDatas seen before has gone. */
+  QSet<QString> words() const;
+public:
+  int pgno;
+private:
+  void apply(QHash<QString, int> const &delta,
+             QSet<QString> &added, QSet<QString> &removed);
+private:
+  QHash<QString, int> counts;
+  QList< QPointer<TextData> > known;
+};
+
+void WordTally::apply(QHash<QString, int> const &delta,
+                      QSet<QString> &added, QSet<QString> &removed) {
+  for (auto i=delta.constBegin(); i!=delta.constEnd(); ++i) {
+    if (i.value()==0)
+      continue;
+    int n0 = counts.value(i.key(), 0);
+    int n1 = n0 + i.value();
+    if (n1>0)
+      counts[i.key()] = n1;
+    else
+      counts.remove(i.key());
+    if (n0<=0 && n1>0)
+      added.insert(i.key());
+    else if (n0>0 && n1<=0)
+      removed.insert(i.key());
+  }
+}
+
+void WordTally::recount(QList<TextData *> const &texts,
+                        QSet<QString> &added, QSet<QString> &removed) {
+  QHash<QString, int> delta;
+  for (TextData *td: texts) {
+    td->takeWordChanges();
+    QHash<QString, int> const &c = td->wordCounts();
+    for (auto i=c.constBegin(); i!=c.constEnd(); ++i)
+      delta[i.key()] += i.value();
+  }
+  for (auto i=counts.constBegin(); i!=counts.constEnd(); ++i)
+    delta[i.key()] -= i.value();
+  apply(delta, added, removed);
+  known.clear();
+  for (TextData *td: texts)
+    known << td;
+}
+
+bool WordTally::update(QList<TextData *> const &texts,
+                       QSet<QString> &added, QSet<QString> &removed) {
+  QSet<TextData *> now = QSet<TextData *>::fromList(texts);
+  for (QPointer<TextData> const &td: known)
+    if (!td || !now.contains(td))
+      return false;
+  /* A word may move from one TextData to another, so we add up all the
+     changes before deciding what was added or removed. */
+  QHash<QString, int> delta;
+  for (TextData *td: texts) {
+    QHash<QString, int> c = td->takeWordChanges();
+    for (auto i=c.constBegin(); i!=c.constEnd(); ++i)
+      delta[i.key()] += i.value();
+  }
+  apply(delta, added, removed);
+  if (known.size()!=texts.size()) {
+    known.clear();
+    for (TextData *td: texts)
+      known << td;
+  }
+  return true;
+}
+
+QSet<QString> WordTally::words() const {
+  QSet<QString> ws;
+  ws.reserve(counts.size());
+  for (auto i=counts.constBegin(); i!=counts.constEnd(); ++i)
+    ws.insert(i.key());
+  return ws;
+}
+
+static void collectTexts(Data *d, QList<TextData *> &texts) {
+  TextData *td = dynamic_cast<TextData *>(d);
+  if (td)
+    texts << td;
+  for (Data *c: d->allChildren())
+    collectTexts(c, texts);
+}
 
 Index::Index(QString rootDir, class TOC *toc, QObject *parent):
   QObject(parent), rootdir(rootDir) {
   widx = new WordIndex(this);
   mp = new QSignalMapper(this);
-  saveTimer = new QTimer(this);
-  connect(saveTimer, SIGNAL(timeout()), SLOT(flush()));
+  // We save along with the notebook's DataFiles
+  connect(SaveScheduler::instance(), SIGNAL(flushing()), SLOT(flush()));
   connect(mp, SIGNAL(mapped(QObject*)), SLOT(updateEntry(QObject*)));
-  QString fn = rootdir + "/index.json";
+  /* Building or updating the index happens in the background; the
+     index is saved when it is done. */
+  connect(widx, SIGNAL(ready()), SLOT(wordsReady()));
+  needToSave = false;
+  QString fn = rootdir + "/index.eli";
+  QString oldfn = rootdir + "/index.json";
   if (QFile(fn).exists()) {
     widx->load(fn);
-    if (widx->update(toc, rootdir + "/pages"))
-      widx->save(fn);
+    widx->update(toc, rootdir + "/pages");
+  } else if (QFile(oldfn).exists()) {
+    // Migrate from the older json format
+    widx->load(oldfn);
+    migrateFrom = oldfn;
+    if (!widx->update(toc, rootdir + "/pages"))
+      wordsReady();
   } else {
-    if (widx->build(toc, rootdir + "/pages"))
-      widx->save(fn);
+    widx->build(toc, rootdir + "/pages");
+  }
+
+  pidx = 0;
+  needToSavePhrases = false;
+  QString pfn = rootdir + "/phrases.eli";
+  if (PhraseIndex::isEnabled()) {
+    pidx = new PhraseIndex(this);
+    connect(pidx, SIGNAL(ready()), SLOT(phrasesReady()));
+    pidx->load(pfn);
+    if (pidx->update(toc, rootdir + "/pages") && !pidx->isBuilding())
+      pidx->save(pfn);
+  } else if (QFile(pfn).exists()) {
+    // It would only go stale
+    QFile::remove(pfn);
   }
-  needToSave = false;
 }
 
 Index::~Index() {
   flush();
+  qDeleteAll(tallies);
 }
 
 void Index::watchEntry(Entry *e) {
@@ -57,13 +179,13 @@ void Index::watchEntry(Entry *e) {
   ASSERT(d);
   EntryFile *f = e->file();
   ASSERT(f);
-  int pgno = d->startPage();
   connect(f, SIGNAL(saved()), mp, SLOT(map()), Qt::UniqueConnection);
   connect(e->lateNoteManager(), SIGNAL(mod()),
 	  mp, SLOT(map()), Qt::UniqueConnection);
-  oldsets[pgno] = e->wordSet();
   mp->setMapping(f, e);
   mp->setMapping(e->lateNoteManager(), e);
+  connect(e, SIGNAL(destroyed(QObject*)), SLOT(forgetEntry(QObject*)),
+          Qt::UniqueConnection);
 }
 
 void Index::unwatchEntry(Entry *e) {
@@ -72,12 +194,30 @@ void Index::unwatchEntry(Entry *e) {
   ASSERT(d);
   EntryFile *f = e->file();
   ASSERT(f);
-  int pgno = d->startPage();
   disconnect(f, SIGNAL(saved()), mp, SLOT(map()));
   disconnect(e->lateNoteManager(), SIGNAL(mod()), mp, SLOT(map()));
   mp->removeMappings(f);
   mp->removeMappings(e->lateNoteManager());
-  oldsets.remove(pgno);
+  disconnect(e, SIGNAL(destroyed(QObject*)),
+             this, SLOT(forgetEntry(QObject*)));
+  forgetEntry(e);
+}
+
+void Index::forgetEntry(QObject *obj) {
+  delete tallies.take(obj);
+}
+
+void Index::forgetPage(int pgno) {
+  /* Someone else has told the word index what is on the page, so the
+     next update must start from scratch. */
+  for (auto i=tallies.begin(); i!=tallies.end(); ) {
+    if (i.value()->pgno==pgno) {
+      delete i.value();
+      i = tallies.erase(i);
+    } else {
+      ++i;
+    }
+  }
 }
 
 void Index::deleteEntry(Entry *e) {
@@ -86,32 +226,99 @@ void Index::deleteEntry(Entry *e) {
   ASSERT(d);
   int pgno = d->startPage();
   words()->dropEntry(pgno);
+  if (pidx) {
+    pidx->dropEntry(pgno);
+    needToSavePhrases = true;
+  }
   unwatchEntry(e);
 }
 
+void Index::reindexPage(int pgno, EntryData const *data) {
+  forgetPage(pgno);
+  widx->rebuildEntry(pgno, data->wordSet());
+  if (pidx)
+    needToSavePhrases = pidx->rebuildEntry(pgno, data) || needToSavePhrases;
+  needToSave = true;
+  SaveScheduler::instance()->saveSoon();
+}
+
+void Index::dropPage(int pgno) {
+  forgetPage(pgno);
+  widx->dropEntry(pgno);
+  if (pidx) {
+    pidx->dropEntry(pgno);
+    needToSavePhrases = true;
+  }
+  needToSave = true;
+  SaveScheduler::instance()->saveSoon();
+}
+
 void Index::flush() {
-  saveTimer->stop();
   if (needToSave)
-    words()->save(rootdir + "/index.json");
+    words()->save(rootdir + "/index.eli");
   needToSave = false;
+  if (needToSavePhrases)
+    pidx->save(rootdir + "/phrases.eli");
+  needToSavePhrases = false;
 }
 
 WordIndex *Index::words() const {
   return widx;
 }
 
+void Index::wordsReady() {
+  // The build may have merged in older versions of open pages
+  qDeleteAll(tallies);
+  tallies.clear();
+  needToSave = true;
+  flush();
+  if (!migrateFrom.isEmpty() && QFile(rootdir + "/index.eli").exists()) {
+    QFile::remove(migrateFrom);
+    migrateFrom = "";
+  }
+}
+
+void Index::phrasesReady() {
+  needToSavePhrases = true;
+  flush();
+}
+
+PhraseIndex *Index::phrases() const {
+  return pidx;
+}
+
 void Index::updateEntry(QObject *obj) {
   Entry *e = dynamic_cast<Entry *>(obj);
   ASSERT(e);
   EntryData *d = e->data();
   ASSERT(d);
-  QSet<QString> words = e->wordSet();
   int pgno = d->startPage();
 
-  if (words!=oldsets[pgno]) {
-    widx->rebuildEntry(pgno, words, &oldsets[pgno]);
-    oldsets[pgno] = words;
+  QList<TextData *> texts;
+  collectTexts(d, texts);
+  collectTexts(e->lateNoteManager(), texts);
+  QSet<QString> added, removed;
+  bool changed;
+  WordTally *tally = tallies.value(obj, 0);
+  if (tally && tally->pgno==pgno && tally->update(texts, added, removed)) {
+    changed = widx->updateEntry(pgno, added, removed);
+  } else {
+    // First time, or a TextData has gone: start from the full counts
+    if (!tally || tally->pgno!=pgno) {
+      delete tally;
+      tally = new WordTally(pgno);
+      tallies[obj] = tally;
+    }
+    tally->recount(texts, added, removed);
+    changed = widx->rebuildEntry(pgno, tally->words());
+  }
+
+  if (changed) {
     needToSave = true;
-    saveTimer->start(INDEX_SAVEIVAL_S * 1000);
+    SaveScheduler::instance()->saveSoon();
+  }
+  if (pidx && pidx->rebuildEntry(pgno, d, e->lateNoteManager()->notes())) {
+    needToSavePhrases = true;
+    SaveScheduler::instance()->saveSoon();
   }
 }
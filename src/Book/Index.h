@@ -32,17 +32,32 @@ public:
   void watchEntry(Entry *);
   void unwatchEntry(Entry *);
   void deleteEntry(Entry *);
+  void reindexPage(int pgno, class EntryData const *data);
+  void dropPage(int pgno);
+  /* For pages changed on disk by others while not open. */
   class WordIndex *words() const;
+  class PhraseIndex *phrases() const;
+  /* Null unless the positional index is enabled. */
 public slots:
   void updateEntry(QObject *);
   void flush();
+private slots:
+  void wordsReady();
+  void phrasesReady();
+  void forgetEntry(QObject *);
+private:
+  void forgetPage(int pgno);
 private:
   class WordIndex *widx;
-  QMap<int, QSet<QString> > oldsets;
+  class PhraseIndex *pidx;
   QString rootdir;
+  QString migrateFrom; // older index file to remove once saved
   class QSignalMapper *mp;
+  QMap<QObject *, class WordTally *> tallies;
+  /* Word counts for watched entries, so that updateEntry only needs to
+     pass on what changed. */
   bool needToSave;
-  class QTimer *saveTimer;
+  bool needToSavePhrases;
 };
 
 #endif
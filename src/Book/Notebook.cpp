@@ -27,10 +27,18 @@
 #include "Index.h"
 #include "Translate.h"
 #include "Catalog.h"
+#include "SaveScheduler.h"
+#include "BackgroundSaver.h"
+#include "PageCache.h"
+#include "StartupProfile.h"
+#include "TOCEntry.h"
+#include "EntryData.h"
 
 #include <QApplication>
 #include <QMessageBox>
 #include <QTimer>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
 #include <QDebug>
 #include <QProcess>
 #include "RmDir.h"
@@ -55,6 +63,9 @@ Notebook::Notebook(QString path, bool ro0): root(QDir(path)), ro(ro0) {
   index_ = 0;
   tocFile_ = 0;
   bookFile_ = 0;
+  catalog_ = 0;
+  watcher_ = 0;
+  pagesTimer_ = 0;
   mode_ = new Mode(isReadOnly(), this);
 }
 
@@ -62,20 +73,48 @@ void Notebook::load() {
   if (bookFile_)
     return;
   
-  QString bookfile = root.exists("book.eln") ? "book.eln" : "book.json";    
-  bookFile_ = BookFile::load(root.filePath(bookfile), this);
-  if (!bookFile_)
-    throw QString("Could not load book file.");
-  bookFile_->data()->setBook(this);
+  { StartupProfile::Phase p("book file");
+    QString bookfile = root.exists("book.eln") ? "book.eln" : "book.json";
+    bookFile_ = BookFile::load(root.filePath(bookfile), this);
+    if (!bookFile_)
+      throw QString("Could not load book file.");
+    bookFile_->data()->setBook(this);
+  }
+
+  if (!isReadOnly())
+    enablePageCache();
 
   qDebug() << "Cataloging pages for " << root.absolutePath();
-  Catalog cat(root.filePath("pages"));
+  { StartupProfile::Phase p("catalog");
+    catalog_ = new Catalog(root.filePath("pages"), true);
+  }
+  { StartupProfile::Phase p("toc");
+    loadTOC();
+  }
+  
+  { StartupProfile::Phase p("index");
+    index_ = new Index(dirPath(), toc(), this);
+  }
+
+  { StartupProfile::Phase p("style");
+    style_ = new Style(root.filePath("style.json"));
+  }
+
+  RecentBooks::instance()->addBook(this);
+  
+  connect(bookFile_->data(), SIGNAL(mod()), this, SIGNAL(mod()));
+  connect(tocFile_->data(), SIGNAL(mod()), this, SIGNAL(mod()));
+
+  if (!isReadOnly())
+    watchPages();
+}
 
+void Notebook::loadTOC() {
   qDebug() << "Loading TOC for " << root.absolutePath();
   tocFile_ = TOCFile::load(root.filePath("toc.json"), this);
   if (tocFile_) {
     qDebug() << "Updating TOC";
-    if (tocFile_->data()->update(cat)) {
+    if (tocFile_->data()->update(*catalog_)) {
       qDebug() << "TOC updated";
     } else {
       qDebug() << "TOC update failed - will rebuild TOC and index";
@@ -83,6 +122,8 @@ void Notebook::load() {
       tocFile_ = 0;
       root.remove("toc.json");
       root.remove("index.json");
+      root.remove("index.eli");
+      root.remove("phrases.eli");
     }
   } else {
     qDebug() << "No TOC file found";
@@ -95,25 +136,129 @@ void Notebook::load() {
       throw QString("Could not rebuild TOC");
     tocFile_ = TOCFile::createFromData(t, root.filePath("toc.json"));
     tocFile_->saveNow(true);
+    catalog_->refresh(); // rebuilding may have renamed files
   }
   if (!tocFile_)
     throw QString("Could not load TOC");
   
   tocFile_->data()->setBook(this);
-
-  index_ = new Index(dirPath(), toc(), this);
-
-  style_ = new Style(root.filePath("style.json"));
-
-  RecentBooks::instance()->addBook(this);
-  
-  connect(bookFile_->data(), SIGNAL(mod()), this, SIGNAL(mod()));
-  connect(tocFile_->data(), SIGNAL(mod()), this, SIGNAL(mod()));
 }
 
 Notebook::~Notebook() {
   if (needToSave())
     qDebug() << "WARNING: Notebook destructed while needing to save";
+  if (catalog_) {
+    if (!isReadOnly()) {
+      /* Our own saves are not yet reflected. Bringing the catalog up to
+         date here means the next load does not have to. */
+      if (QFileInfo(catalog_->path()).lastModified()!=catalog_->dirMod())
+        catalog_->refresh();
+      catalog_->saveSnapshot();
+    }
+    delete catalog_;
+  }
+}
+
+void Notebook::watchPages() {
+  /* External changes to the pages folder, e.g., from a "git pull", are
+     applied to the TOC and the index as they happen. Our own saves
+     trigger the watcher too; the BackgroundSaver tells the catalog about
+     them, so that they do not cost a rescan of the folder. */
+  watcher_ = new QFileSystemWatcher(this);
+  if (!watcher_->addPath(root.filePath("pages"))) {
+    qDebug() << "Notebook: cannot watch pages folder";
+    return;
+  }
+  pagesTimer_ = new QTimer(this);
+  pagesTimer_->setSingleShot(true);
+  pagesTimer_->setInterval(1000); // let bulk changes settle
+  connect(watcher_, SIGNAL(directoryChanged(QString)), SLOT(pagesChanged()));
+  connect(pagesTimer_, SIGNAL(timeout()), SLOT(applyPageChanges()));
+  connect(BackgroundSaver::instance(),
+          SIGNAL(written(QString, QDateTime, qint64, QDateTime, QDateTime)),
+          SLOT(pageWritten(QString, QDateTime, qint64, QDateTime, QDateTime)));
+}
+
+void Notebook::pageWritten(QString fn, QDateTime mod, qint64 size,
+                           QDateTime dirBefore, QDateTime dirAfter) {
+  catalog_->absorbWrite(fn, mod, size, dirBefore, dirAfter);
+}
+
+void Notebook::pagesChanged() {
+  pagesTimer_->start();
+}
+
+bool Notebook::isOpen(int pgno) const {
+  return pgFiles.contains(pgno) && pgFiles[pgno];
+}
+
+void Notebook::applyPageChanges() {
+  if (isReadOnly())
+    return;
+  if (QFileInfo(catalog_->path()).lastModified()==catalog_->dirMod())
+    return; // nothing but our own saves, which the catalog has absorbed
+  Catalog::Changes changes = catalog_->refresh();
+  if (changes.isEmpty())
+    return;
+  if (!catalog_->errors().isEmpty())
+    qDebug() << "Notebook: pages folder has problems:" << catalog_->errors();
+
+  QDir pages(root.filePath("pages"));
+  QRegExp re("^(\\d\\d*)(-([a-z0-9]+))?.json");
+  QMultiMap<int, QString> const &pg2file = catalog_->pageToFileMap();
+
+  for (QString fn: changes.removed) {
+    if (!re.exactMatch(fn))
+      continue;
+    int pgno = re.cap(1).toInt();
+    QString uuid = re.cap(3);
+    if (isOpen(pgno)) {
+      qDebug() << "Notebook: open page removed from disk:" << fn;
+      continue;
+    }
+    TOCEntry *e = toc()->entries().value(pgno, 0);
+    if (e && e->uuid()==uuid) {
+      qDebug() << "Notebook: page removed from disk:" << fn;
+      index_->dropPage(pgno);
+      toc()->deleteEntry(e);
+    }
+  }
+
+  for (QString fn: changes.added + changes.modified) {
+    if (!re.exactMatch(fn))
+      continue;
+    int pgno = re.cap(1).toInt();
+    QString uuid = re.cap(3);
+    if (isOpen(pgno))
+      continue; // presumably our own save
+    if (pg2file.count(pgno)>1) {
+      qDebug() << "Notebook: duplicate page on disk:" << fn;
+      continue;
+    }
+    TOCEntry *e = toc()->entries().value(pgno, 0);
+    if (e && e->uuid()!=uuid) {
+      qDebug() << "Notebook: page replaced on disk:" << fn;
+      continue;
+    }
+    if (e && catalog_->fileMod(fn) <= e->lastSeen().addSecs(1))
+      continue;
+    EntryFile *f = ::loadEntry(pages, pgno, uuid, 0);
+    if (!f) {
+      qDebug() << "Notebook: cannot load changed page:" << fn;
+      continue;
+    }
+    if (f->data()->startPage()==pgno) {
+      qDebug() << "Notebook: page changed on disk:" << fn;
+      if (e)
+        toc()->updateEntry(f->data());
+      else
+        toc()->addEntry(f->data());
+      index_->reindexPage(pgno, f->data());
+    } else {
+      qDebug() << "Notebook: page number mismatch in" << fn;
+    }
+    delete f;
+  }
 }
 
 Style const &Notebook::style() const {
@@ -203,6 +348,9 @@ bool Notebook::createGitArchive(QDir d) {
     ignore.write(".*~\n");
     ignore.write("toc.json\n");
     ignore.write("index.json\n");
+    ignore.write("index.eli\n");
+    ignore.write("phrases.eli\n");
+    ignore.write(".cache/\n");
   }
 
   proc.start("git", QStringList() << "add" << ".");
@@ -227,6 +375,32 @@ bool Notebook::createGitArchive(QDir d) {
   return true;
 }
 
+void Notebook::enablePageCache() {
+  /* The cache must never end up in the archive, and neither must the
+     binary search indices. We only know how to tell git that, so under
+     bzr, we do without the cache. */
+  QString vc = checkVersionControl();
+  if (vc=="git") {
+    QFile ignore(root.absoluteFilePath(".gitignore"));
+    if (!ignore.open(QFile::ReadWrite | QFile::Text))
+      return;
+    QStringList lines = QString::fromUtf8(ignore.readAll()).split("\n");
+    bool needsep = ignore.size()>0 && !lines.last().isEmpty();
+    for (QString pat: QStringList() << ".cache/" << "index.eli" << "phrases.eli") {
+      if (!lines.contains(pat)) {
+        if (needsep)
+          ignore.write("\n");
+        needsep = false;
+        ignore.write((pat + "\n").toUtf8());
+      }
+    }
+  } else if (vc!="") {
+    return;
+  }
+  if (!PageCache::enable(root.filePath("pages")))
+    qDebug() << "Notebook: Could not create page cache";
+}
+
 void Notebook::copyStyleFile(QDir d, QString vc) {
   QFile styleIn(":/style.json");
   QFile styleOut(d.filePath("style.json"));
@@ -377,26 +551,15 @@ bool Notebook::needToSave() const {
 }  
 
 bool Notebook::flush() {
-  bool actv = false;
-  bool ok = true;
+  bool actv = needToSave();
+  bool bookmod = bookFile_->needToSave();
 
-  if (tocFile_->needToSave()) {
-    actv = true;
-    ok = ok && tocFile_->saveNow();
-  }
+  /* This saves the TOC, the book file, all entries, and their late notes
+     in one pass, and waits until they are on the disk. */
+  bool ok = SaveScheduler::instance()->flushBarrier();
 
-  if (bookFile_->needToSave()) {
-    actv = true;
-    ok = ok && bookFile_->saveNow();
+  if (bookmod)
     RecentBooks::instance()->addBook(this);
-  }
-
-  foreach (CachedEntry pf, pgFiles) {
-    if (pf && pf.needToSave()) {
-      actv = true;
-      ok = ok && pf.saveNow();
-    }
-  }
 
   index_->flush();
 
@@ -423,6 +586,8 @@ CachedEntry Notebook::recoverFromExistingEntry(int pgno) {
   flush();
   root.remove("toc.json");
   root.remove("index.json");
+  root.remove("index.eli");
+  root.remove("phrases.eli");
   ::exit(1);
   return CachedEntry();
 }
@@ -437,6 +602,8 @@ EntryFile *Notebook::recoverFromMissingEntry(int pgno) {
   flush();
   root.remove("toc.json");
   root.remove("index.json");
+  root.remove("index.eli");
+  root.remove("phrases.eli");
   ::exit(1);
   return 0;
 }
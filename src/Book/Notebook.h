@@ -27,6 +27,7 @@
 #include "BookFile.h"
 #include "TOCFile.h"
 #include <QMap>
+#include <QDateTime>
 
 class Notebook: public QObject {
   Q_OBJECT;
@@ -71,12 +72,20 @@ private:
 private slots:
   void titleMod();
   void sheetCountMod();
+  void pagesChanged();
+  void applyPageChanges();
+  void pageWritten(QString fn, QDateTime mod, qint64 size,
+                   QDateTime dirBefore, QDateTime dirAfter);
 private:
   CachedEntry recoverFromExistingEntry(int pgno);
   EntryFile *recoverFromMissingEntry(int pgno);
   static QString &errMsg();
   static void copyStyleFile(QDir, QString vc);
   static bool createGitArchive(QDir);
+  void enablePageCache();
+  void loadTOC();
+  void watchPages();
+  bool isOpen(int pgno) const;
 private:
   QDir root;
   bool ro;
@@ -84,6 +93,9 @@ private:
   TOCFile *tocFile_;
   BookFile *bookFile_;
   Index *index_;
+  class Catalog *catalog_; // kept current while the book is open
+  class QFileSystemWatcher *watcher_;
+  class QTimer *pagesTimer_;
   Style const *style_;
   class Mode *mode_;
 };
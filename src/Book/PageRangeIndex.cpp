@@ -0,0 +1,151 @@
+// Book/PageRangeIndex.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PageRangeIndex.C
+
+#include "PageRangeIndex.h"
+#include "TOCEntry.h"
+#include <algorithm>
+#include <limits.h>
+
+PageRangeIndex::PageRangeIndex() {
+  valid = false;
+  leaves = 0;
+}
+
+void PageRangeIndex::invalidate() {
+  valid = false;
+  ents.clear();
+  starts.clear();
+  tree.clear();
+  leaves = 0;
+}
+
+void PageRangeIndex::rebuild(QList<TOCEntry *> const &sortedByStart) {
+  int n = sortedByStart.size();
+  ents.resize(n);
+  starts.resize(n);
+  leaves = 1;
+  while (leaves<n)
+    leaves *= 2;
+  tree.fill(INT_MIN, 2*leaves);
+  for (int k=0; k<n; k++) {
+    TOCEntry *e = sortedByStart[k];
+    ents[k] = e;
+    starts[k] = e->startPage();
+    tree[leaves+k] = e->startPage() + e->sheetCount();
+  }
+  for (int j=leaves-1; j>0; j--)
+    tree[j] = qMax(tree[2*j], tree[2*j+1]);
+  valid = true;
+}
+
+void PageRangeIndex::resize(TOCEntry *e) {
+  if (!valid)
+    return;
+  int k = std::lower_bound(starts.constBegin(), starts.constEnd(),
+                           e->startPage()) - starts.constBegin();
+  if (k>=ents.size() || ents[k]!=e)
+    return; // not (yet) indexed
+  int j = leaves + k;
+  tree[j] = e->startPage() + e->sheetCount();
+  for (j/=2; j>0; j/=2)
+    tree[j] = qMax(tree[2*j], tree[2*j+1]);
+}
+
+int PageRangeIndex::lastStartingBy(int page) const {
+  return std::upper_bound(starts.constBegin(), starts.constEnd(), page)
+    - starts.constBegin() - 1;
+}
+
+int PageRangeIndex::lastEndingAfter(int k, int page) const {
+  if (k<0 || ents.isEmpty())
+    return -1;
+  return lastEndingAfter(1, 0, leaves-1, k, page);
+}
+
+int PageRangeIndex::lastEndingAfter(int node, int lo, int hi,
+                                    int k, int page) const {
+  if (lo>k || tree[node]<=page)
+    return -1;
+  if (lo==hi)
+    return lo;
+  int mid = (lo + hi) / 2;
+  int r = lastEndingAfter(2*node+1, mid+1, hi, k, page);
+  if (r>=0)
+    return r;
+  return lastEndingAfter(2*node, lo, mid, k, page);
+}
+
+int PageRangeIndex::firstEndingAfter(int page) const {
+  if (ents.isEmpty() || tree[1]<=page)
+    return -1;
+  int j = 1;
+  while (j<leaves)
+    j = tree[2*j]>page ? 2*j : 2*j+1;
+  return j - leaves;
+}
+
+#if 0
+// Benchmark: lookups in a TOC with 20000 entries, against a linear scan
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QDebug>
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  int const N = 20000;
+  QList<TOCEntry *> list;
+  int pg = 1;
+  for (int k=0; k<N; k++) {
+    TOCEntry *e = new TOCEntry();
+    e->setStartPage(pg);
+    e->setSheetCount(1 + k%3);
+    pg += (k%7==0) ? 1 : e->sheetCount(); // some overlap
+    list << e;
+  }
+  PageRangeIndex idx;
+  QElapsedTimer t;
+  t.start();
+  idx.rebuild(list);
+  qDebug() << "Build:" << t.nsecsElapsed()/1000 << "us";
+
+  int const Q = 100000;
+  t.restart();
+  qint64 sum0 = 0;
+  for (int q=0; q<Q/100; q++) {
+    int p = (q*7919) % pg;
+    TOCEntry *r = 0;
+    for (TOCEntry *e: list)
+      if (e->contains(p))
+        r = e;
+    sum0 += r ? r->startPage() : 0;
+  }
+  qDebug() << "Linear:" << t.nsecsElapsed()/(Q/100) << "ns per lookup";
+
+  t.restart();
+  qint64 sum1 = 0;
+  for (int q=0; q<Q; q++) {
+    int p = (q*7919) % pg;
+    int k = idx.lastEndingAfter(idx.lastStartingBy(p), p);
+    if (q<Q/100)
+      sum1 += k<0 ? 0 : idx.at(k)->startPage();
+  }
+  qDebug() << "Indexed:" << t.nsecsElapsed()/Q << "ns per lookup";
+  qDebug() << "Identical:" << (sum0==sum1);
+  return 0;
+}
+#endif
@@ -0,0 +1,63 @@
+// Book/PageRangeIndex.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PageRangeIndex.H
+
+#ifndef PAGERANGEINDEX_H
+
+#define PAGERANGEINDEX_H
+
+#include <QVector>
+#include <QList>
+
+class PageRangeIndex {
+  /* Ordered index of the page ranges of a TOC's entries, for lookups in
+     O(log n). Entries are kept sorted by start page, next to a max-tree
+     of their end pages (one past the last page). The tree lets us find
+     the latest entry that still extends beyond a given page even when
+     ranges overlap, as they do when a non-final entry has grown extra
+     sheets ("12a", "12b", ...).
+     Adding or removing entries simply invalidates the index; it is
+     rebuilt on the next query. A change in the sheet count of an entry
+     is applied in place. */
+public:
+  PageRangeIndex();
+  bool isValid() const { return valid; }
+  void invalidate();
+  void rebuild(QList<class TOCEntry *> const &sortedByStart);
+  void resize(TOCEntry *e);
+  /* Updates the end page of E after a change in its sheet count. */
+  int size() const { return ents.size(); }
+  TOCEntry *at(int k) const { return ents[k]; }
+  int lastStartingBy(int page) const;
+  /* Returns the index of the last entry with startPage <= PAGE, or -1. */
+  int lastEndingAfter(int k, int page) const;
+  /* Returns the index of the last entry at or before index K that
+     extends beyond PAGE, or -1. */
+  int firstEndingAfter(int page) const;
+  /* Returns the index of the first entry that extends beyond PAGE,
+     or -1. */
+private:
+  int lastEndingAfter(int node, int lo, int hi, int k, int page) const;
+private:
+  bool valid;
+  QVector<TOCEntry *> ents;
+  QVector<int> starts;
+  QVector<int> tree; // heap layout; leaves hold end pages
+  int leaves; // number of leaves, a power of two
+};
+
+#endif
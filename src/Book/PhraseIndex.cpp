@@ -0,0 +1,454 @@
+// Book/PhraseIndex.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseIndex.C
+
+#include "PhraseIndex.h"
+#include "TOC.h"
+#include "TOCEntry.h"
+#include "EntryFile.h"
+#include "EntryData.h"
+#include "TitleData.h"
+#include "BlockData.h"
+#include "TextData.h"
+#include "TableData.h"
+#include "GfxNoteData.h"
+#include "LateNoteData.h"
+#include "LateNoteManager.h"
+#include "WordTokenizer.h"
+#include <QSettings>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+
+static quint32 const phraseMagic = 0x454c4e50; // "ELNP"
+static quint32 const phraseVersion = 1;
+
+static void tokenize(QString const &text, QStringList &words,
+                     QVector<int> &offsets) {
+  // Same words as TextData::wordSet(), but we also want to know where
+  WordTokenizer::words(text, words, offsets);
+}
+
+bool PhraseIndex::isEnabled() {
+  QSettings s("net.danielwagenaar", "eln");
+  return s.value("search/positional", false).toBool();
+}
+
+PhraseIndex::PhraseIndex(QObject *parent): QObject(parent) {
+  watcher = 0;
+}
+
+PhraseIndex::~PhraseIndex() {
+  if (watcher) {
+    watcher->cancel();
+    watcher->waitForFinished();
+  }
+}
+
+bool PhraseIndex::Record::operator==(Record const &r) const {
+  // Tokens follow from the context, so we need not compare them
+  return entryPage==r.entryPage && page==r.page && type==r.type
+    && cre==r.cre && mod==r.mod && context==r.context;
+}
+
+int PhraseIndex::wordId(QString word) {
+  auto i = wordIds.constFind(word);
+  if (i!=wordIds.constEnd())
+    return i.value();
+  int id = wordIds.size();
+  wordIds[word] = id;
+  return id;
+}
+
+QSet<QString> PhraseIndex::recordsWith(int wordid) const {
+  return wordRecords.value(wordid);
+}
+
+QSet<int> PhraseIndex::idsWithPrefix(QString wordbit) const {
+  QSet<int> ids;
+  for (auto i = wordIds.lowerBound(wordbit);
+       i!=wordIds.end() && i.key().startsWith(wordbit); ++i)
+    if (wordRecords.contains(i.value()))
+      ids << i.value();
+  return ids;
+}
+
+void PhraseIndex::addRecord(QString uuid, Record const &rec0) {
+  removeRecord(uuid);
+  Record rec = rec0;
+  QStringList words;
+  rec.offsets.clear();
+  tokenize(rec.context, words, rec.offsets);
+  rec.tokens.resize(words.size());
+  for (int k=0; k<words.size(); k++) {
+    int id = wordId(words[k]);
+    rec.tokens[k] = id;
+    wordRecords[id].insert(uuid);
+  }
+  records[uuid] = rec;
+  entryRecords[rec.entryPage] << uuid;
+}
+
+void PhraseIndex::removeRecord(QString uuid) {
+  auto i = records.find(uuid);
+  if (i==records.end())
+    return;
+  for (int id: i.value().tokens) {
+    auto j = wordRecords.find(id);
+    if (j!=wordRecords.end()) {
+      j.value().remove(uuid);
+      if (j.value().isEmpty())
+        wordRecords.erase(j);
+    }
+  }
+  int pg = i.value().entryPage;
+  entryRecords[pg].removeAll(uuid);
+  if (entryRecords[pg].isEmpty())
+    entryRecords.remove(pg);
+  records.erase(i);
+}
+
+void PhraseIndex::collect(QList< QPair<QString, Record> > &dest,
+                          int startPage, Data const *data, int dataPage) {
+  // Walks the tree just like Search::addToResults
+  foreach (Data const *d, data->allChildren()) {
+    TextData const *td = dynamic_cast<TextData const *>(d);
+    if (td && !td->text().isEmpty()) {
+      Record rec;
+      rec.entryPage = startPage;
+      rec.page = dataPage;
+      rec.type = Search::resultType(data);
+      TableData const *tbld = dynamic_cast<TableData const *>(td);
+      rec.context = tbld ? Search::untable(tbld) : td->text();
+      rec.cre = td->created();
+      rec.mod = td->modified();
+      dest << QPair<QString, Record>(td->uuid(), rec);
+    }
+    GfxNoteData const *nd = dynamic_cast<GfxNoteData const *>(d);
+    int childSheet = nd ? nd->sheet() : -1;
+    int childPage = childSheet>=0 ? startPage + childSheet : dataPage;
+    collect(dest, startPage, d, childPage);
+  }
+}
+
+void PhraseIndex::collectEntry(QList< QPair<QString, Record> > &dest,
+                               int startPage, EntryData const *data,
+                               QList<LateNoteData *> notes) {
+  foreach (TitleData const *bd, data->children<TitleData>())
+    collect(dest, startPage, bd, startPage);
+  foreach (BlockData const *bd, data->children<BlockData>())
+    collect(dest, startPage, bd, startPage + bd->sheet());
+  foreach (LateNoteData const *bd, notes)
+    collect(dest, startPage, bd, startPage + bd->sheet());
+}
+
+bool PhraseIndex::rebuildEntry(int startPage, EntryData const *data,
+                               QList<LateNoteData *> notes) {
+  if (watcher)
+    touched << startPage;
+  QList< QPair<QString, Record> > recs;
+  collectEntry(recs, startPage, data, notes);
+  return setEntryRecords(startPage, recs);
+}
+
+bool PhraseIndex::setEntryRecords(int startPage,
+                                  QList< QPair<QString, Record> > const &recs) {
+  lastseen[startPage] = QDateTime::currentDateTime();
+
+  QStringList old = entryRecords.value(startPage);
+  bool same = old.size()==recs.size();
+  for (int k=0; same && k<recs.size(); k++)
+    same = old[k]==recs[k].first && records[old[k]]==recs[k].second;
+  if (same)
+    return false;
+
+  for (QString uuid: old)
+    removeRecord(uuid);
+  for (auto const &r: recs)
+    addRecord(r.first, r.second);
+  return true;
+}
+
+void PhraseIndex::dropEntry(int startPage) {
+  if (watcher)
+    touched << startPage;
+  lastseen.remove(startPage);
+  for (QString uuid: entryRecords.value(startPage))
+    removeRecord(uuid);
+}
+
+QList<SearchResult> PhraseIndex::findPhrase(QString phrase,
+                                            TOC const *toc) const {
+  QList<SearchResult> results;
+  QStringList words;
+  QVector<int> offsets;
+  tokenize(phrase, words, offsets);
+  if (words.isEmpty())
+    return results;
+
+  int n = words.size();
+  QVector<int> ids(n - 1);
+  for (int k=0; k<n-1; k++) {
+    ids[k] = wordIds.value(words[k], -1);
+    if (ids[k]<0)
+      return results;
+  }
+  QSet<int> lastIds = idsWithPrefix(words.last());
+  if (lastIds.isEmpty())
+    return results;
+
+  QSet<QString> candidates;
+  for (int id: lastIds)
+    candidates |= recordsWith(id);
+  for (int k=0; k<n-1; k++)
+    candidates &= recordsWith(ids[k]);
+
+  QMap<int, QSet<QString> > byEntry;
+  for (QString uuid: candidates)
+    byEntry[records.constFind(uuid)->entryPage] << uuid;
+
+  for (auto i=byEntry.begin(); i!=byEntry.end(); ++i) {
+    int pg = i.key();
+    TOCEntry const *te = toc->entries().value(pg, 0);
+    QString ttl = te ? te->title() : QString();
+    for (QString uuid: entryRecords.value(pg)) {
+      if (!i.value().contains(uuid))
+        continue;
+      Record const &rec = *records.constFind(uuid);
+      QList<int> where;
+      int N = rec.tokens.size();
+      for (int t=0; t+n<=N; t++) {
+        bool match = true;
+        for (int k=0; match && k<n-1; k++)
+          match = rec.tokens[t+k]==ids[k];
+        if (!match || !lastIds.contains(rec.tokens[t+n-1]))
+          continue;
+        // Words match; now check that punctuation and spacing do too
+        int start = rec.offsets[t] - offsets[0];
+        if (start>=0
+            && rec.context.midRef(start, phrase.size())
+            .compare(phrase, Qt::CaseInsensitive)==0)
+          where << start;
+      }
+      if (where.isEmpty())
+        continue;
+      SearchResult res;
+      res.phrase = phrase;
+      res.type = SearchResult::Type(rec.type);
+      res.page = rec.page;
+      res.startPageOfEntry = pg;
+      res.entryTitle = ttl;
+      res.context = rec.context;
+      res.cre = rec.cre;
+      res.mod = rec.mod;
+      res.uuid = uuid;
+      res.whereInContext = where;
+      results << res;
+    }
+  }
+  return results;
+}
+
+struct PhraseIndex::Job {
+  QString pagesDir;
+  int pgno;
+  QString uuid;
+};
+
+struct PhraseIndex::PagePhrases {
+  PagePhrases(): pgno(0), ok(false) { }
+  int pgno;
+  bool ok;
+  QList< QPair<QString, Record> > recs;
+};
+
+PhraseIndex::PagePhrases PhraseIndex::collectPage(Job const &job) {
+  /* Runs in a worker thread, just like indexPage in WordIndex.cpp. The
+     page is loaded privately and deleted right here; only its records
+     are handed back. */
+  PagePhrases res;
+  res.pgno = job.pgno;
+  EntryFile *f = ::loadEntryDetached(job.pagesDir, job.pgno, job.uuid);
+  if (!f)
+    return res;
+  QString notes = f->fileName();
+  notes.replace(".json", ".notes");
+  LateNoteManager lnm(notes, 0, true);
+  collectEntry(res.recs, job.pgno, f->data(), lnm.notes());
+  delete f;
+  res.ok = true;
+  return res;
+}
+
+bool PhraseIndex::update(TOC const *toc, QString pagesDir) {
+  if (watcher) {
+    watcher->cancel();
+    watcher->waitForFinished();
+    updateFinished();
+  }
+  bool changed = false;
+  for (int pg: lastseen.keys()) {
+    if (!toc->entries().contains(pg)) {
+      dropEntry(pg);
+      changed = true;
+    }
+  }
+
+  QList<Job> jobs;
+  for (TOCEntry const *entry: toc->entries()) {
+    int pg = entry->startPage();
+    if (lastseen.contains(pg) && entry->modified()<=lastseen[pg].addSecs(10))
+      continue;
+    Job job;
+    job.pagesDir = pagesDir;
+    job.pgno = pg;
+    job.uuid = entry->uuid();
+    jobs << job;
+  }
+  if (jobs.isEmpty())
+    return changed;
+
+  qDebug() << "PhraseIndex: indexing" << jobs.size() << "pages";
+  merged = QVector<bool>(jobs.size(), false);
+  touched.clear();
+  watcher = new QFutureWatcher<PagePhrases>(this);
+  connect(watcher, SIGNAL(resultReadyAt(int)), SLOT(pageCollected(int)));
+  connect(watcher, SIGNAL(finished()), SLOT(updateFinished()));
+  watcher->setFuture(QtConcurrent::mapped(jobs, collectPage));
+  return true;
+}
+
+void PhraseIndex::mergePage(int k) {
+  // The single merge step; always on the GUI thread
+  if (merged[k] || !watcher->future().isResultReadyAt(k))
+    return;
+  merged[k] = true;
+  PagePhrases res = watcher->resultAt(k);
+  if (touched.contains(res.pgno))
+    return; // reindexed from a newer version in the meantime
+  if (res.ok)
+    setEntryRecords(res.pgno, res.recs);
+  else
+    qDebug() << "PhraseIndex::update - Cannot load entry" << res.pgno;
+}
+
+void PhraseIndex::pageCollected(int k) {
+  mergePage(k);
+}
+
+void PhraseIndex::updateFinished() {
+  if (!watcher)
+    return;
+  for (int k=0; k<merged.size(); k++)
+    mergePage(k);
+  watcher->disconnect(this);
+  watcher->deleteLater();
+  watcher = 0;
+  touched.clear();
+  emit ready();
+}
+
+bool PhraseIndex::save(QString filename) const {
+  /* Word ids are renumbered, so that words that no longer occur
+     anywhere are dropped. */
+  QVector<int> remap(wordIds.size(), -1);
+  QStringList words;
+  for (auto i=wordIds.begin(); i!=wordIds.end(); ++i) {
+    if (wordRecords.contains(i.value())) {
+      remap[i.value()] = words.size();
+      words << i.key();
+    }
+  }
+
+  // The old file stays in place until the new one is complete
+  QSaveFile f(filename);
+  if (!f.open(QFile::WriteOnly)) {
+    qDebug() << "PhraseIndex: Cannot write" << filename;
+    return false;
+  }
+  QDataStream s(&f);
+  s.setVersion(QDataStream::Qt_5_0);
+  s << phraseMagic << phraseVersion;
+  s << lastseen << words << qint32(records.size());
+  for (auto i=entryRecords.begin(); i!=entryRecords.end(); ++i) {
+    for (QString uuid: i.value()) {
+      Record const &rec = *records.constFind(uuid);
+      QVector<int> tokens(rec.tokens.size());
+      for (int k=0; k<tokens.size(); k++)
+        tokens[k] = remap[rec.tokens[k]];
+      s << uuid << qint32(rec.entryPage) << qint32(rec.page)
+        << qint32(rec.type) << rec.cre << rec.mod << rec.context
+        << tokens << rec.offsets;
+    }
+  }
+  if (s.status()!=QDataStream::Ok) {
+    qDebug() << "PhraseIndex: Failed to write" << filename;
+    f.cancelWriting();
+    return false;
+  }
+  return f.commit();
+}
+
+bool PhraseIndex::load(QString filename) {
+  QFile f(filename);
+  if (!f.open(QFile::ReadOnly))
+    return false;
+  QDataStream s(&f);
+  s.setVersion(QDataStream::Qt_5_0);
+  quint32 magic, version;
+  s >> magic >> version;
+  if (magic!=phraseMagic || version!=phraseVersion) {
+    qDebug() << "PhraseIndex: Not a phrase index" << filename;
+    return false;
+  }
+  QStringList words;
+  qint32 n;
+  s >> lastseen >> words >> n;
+  wordIds.clear();
+  for (int k=0; k<words.size(); k++)
+    wordIds[words[k]] = k;
+  records.clear();
+  entryRecords.clear();
+  wordRecords.clear();
+  for (int r=0; r<n && s.status()==QDataStream::Ok; r++) {
+    QString uuid;
+    qint32 entryPage, page, type;
+    Record rec;
+    s >> uuid >> entryPage >> page >> type >> rec.cre >> rec.mod
+      >> rec.context >> rec.tokens >> rec.offsets;
+    rec.entryPage = entryPage;
+    rec.page = page;
+    rec.type = type;
+    for (int id: rec.tokens)
+      wordRecords[id].insert(uuid);
+    records[uuid] = rec;
+    entryRecords[rec.entryPage] << uuid;
+  }
+  if (s.status()!=QDataStream::Ok) {
+    qDebug() << "PhraseIndex: Corrupted" << filename;
+    records.clear();
+    entryRecords.clear();
+    wordRecords.clear();
+    wordIds.clear();
+    lastseen.clear();
+    return false;
+  }
+  return true;
+}
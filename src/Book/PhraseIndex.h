@@ -0,0 +1,104 @@
+// Book/PhraseIndex.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseIndex.H
+
+#ifndef PHRASEINDEX_H
+
+#define PHRASEINDEX_H
+
+#include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QDateTime>
+#include <QFutureWatcher>
+#include "Search.h"
+
+class PhraseIndex: public QObject {
+  /* An optional positional index. For every TextData in the notebook,
+     it keeps the text along with the sequence of its words and their
+     offsets. This lets phrase searches be answered, context and all,
+     without loading any pages. It costs about as much memory as the
+     text of the notebook, which is why it is off by default. Turn it
+     on with the "search/positional" setting. */
+  Q_OBJECT;
+public:
+  static bool isEnabled();
+  PhraseIndex(QObject *parent=0);
+  virtual ~PhraseIndex();
+  bool load(QString filename);
+  bool save(QString filename) const;
+  bool update(class TOC const *, QString pgdir);
+  /* Reindexes pages changed since they were last seen, and returns
+     immediately. As in WordIndex, pages are loaded on a worker pool and
+     merged in on the GUI thread as they come in. Returns true if anything
+     changed. If isBuilding() afterwards, more changes are on their way,
+     and ready() is emitted once they are all in. */
+  bool isBuilding() const { return watcher!=0; }
+  bool rebuildEntry(int startPage, class EntryData const *data,
+                    QList<class LateNoteData *> notes
+                    =QList<class LateNoteData *>());
+  /* Returns true if anything changed. */
+  void dropEntry(int startPage);
+  QList<SearchResult> findPhrase(QString phrase, class TOC const *) const;
+  /* As in Search, the last word of the phrase may be partial. Matches
+     are only found where the phrase starts at the start of a word. */
+signals:
+  void ready(); // update complete
+private slots:
+  void pageCollected(int k);
+  void updateFinished();
+private:
+  struct Record {
+    int entryPage;
+    int page;
+    int type; // SearchResult::Type
+    QDateTime cre, mod;
+    QString context;
+    QVector<int> tokens; // word ids, in order
+    QVector<int> offsets; // offset of each token in context
+    bool operator==(Record const &) const;
+  };
+  static void collect(QList< QPair<QString, Record> > &dest,
+                      int startPage, class Data const *data, int dataPage);
+  static void collectEntry(QList< QPair<QString, Record> > &dest,
+                           int startPage, class EntryData const *data,
+                           QList<class LateNoteData *> notes);
+  struct Job;
+  struct PagePhrases;
+  static PagePhrases collectPage(Job const &job);
+  void mergePage(int k);
+  bool setEntryRecords(int startPage,
+                       QList< QPair<QString, Record> > const &recs);
+  void addRecord(QString uuid, Record const &rec);
+  void removeRecord(QString uuid);
+  int wordId(QString word);
+  QSet<QString> recordsWith(int wordid) const;
+  QSet<int> idsWithPrefix(QString wordbit) const;
+private:
+  QMap<QString, int> wordIds; // sorted, so prefixes are contiguous
+  QHash<QString, Record> records; // by uuid of TextData
+  QMap<int, QStringList> entryRecords; // uuids by start page, in order
+  QHash<int, QSet<QString> > wordRecords; // uuids by word id
+  QMap<int, QDateTime> lastseen;
+  QFutureWatcher<PagePhrases> *watcher; // only while updating
+  QVector<bool> merged; // which results have been merged
+  QSet<int> touched; // pages reindexed by others while updating
+};
+
+#endif
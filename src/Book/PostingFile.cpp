@@ -0,0 +1,451 @@
+// Book/PostingFile.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PostingFile.C
+
+#include "PostingFile.h"
+#include <QtEndian>
+#include <QSaveFile>
+#include <QDebug>
+
+static quint32 const postingMagic = 0x574e4c45; // "ELNW"
+static quint32 const postingVersion = 2;
+static int const headerSize = 40;
+static int const dictEntrySize = 16;
+static int const lastseenEntrySize = 12;
+static int const forwardEntrySize = 12;
+
+static inline quint32 u32At(uchar const *p) {
+  return qFromLittleEndian<quint32>(p);
+}
+
+static inline void putU32(QByteArray &dest, quint32 v) {
+  uchar b[4];
+  qToLittleEndian<quint32>(v, b);
+  dest.append((char const *)b, 4);
+}
+
+PostingFile::PostingFile() {
+  base = 0;
+  size = 0;
+  nWords = 0;
+  nPages = 0;
+  nFwd = 0;
+  dictOffset = stringsOffset = postingsOffset = lastseenOffset = 0;
+  forwardOffset = 0;
+}
+
+PostingFile::~PostingFile() {
+  close();
+}
+
+bool PostingFile::isPostingFile(QString fn) {
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly))
+    return false;
+  QByteArray hdr = f.read(8);
+  return hdr.size()==8
+    && u32At((uchar const *)hdr.constData())==postingMagic;
+}
+
+bool PostingFile::open(QString fn) {
+  close();
+  file.setFileName(fn);
+  if (!file.open(QFile::ReadOnly))
+    return false;
+  size = file.size();
+  base = size>0 ? file.map(0, size) : 0;
+  if (!base) {
+    contents = file.readAll();
+    base = (uchar const *)contents.constData();
+  }
+  if (size<headerSize
+      || u32At(base)!=postingMagic || u32At(base+4)!=postingVersion) {
+    qDebug() << "PostingFile: not a valid index" << fn;
+    close();
+    return false;
+  }
+  nWords = u32At(base+8);
+  nPages = u32At(base+12);
+  nFwd = u32At(base+16);
+  dictOffset = u32At(base+20);
+  stringsOffset = u32At(base+24);
+  postingsOffset = u32At(base+28);
+  lastseenOffset = u32At(base+32);
+  forwardOffset = u32At(base+36);
+  if (nWords<0 || nPages<0 || nFwd<0
+      || dictOffset + qint64(nWords)*dictEntrySize > stringsOffset
+      || stringsOffset > postingsOffset
+      || postingsOffset > lastseenOffset
+      || lastseenOffset + qint64(nPages)*lastseenEntrySize > forwardOffset
+      || forwardOffset + qint64(nFwd)*forwardEntrySize > size
+      || !checkEntries()) {
+    qDebug() << "PostingFile: corrupted index" << fn;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool PostingFile::checkEntries() const {
+  /* Makes sure that no dictionary or forward entry points outside its
+     section, so that lookups need not check. Each page takes at least
+     one byte, which bounds the counts. */
+  quint32 nChars = (postingsOffset - stringsOffset) / 2;
+  quint32 nBytes = lastseenOffset - postingsOffset;
+  quint32 prev = 0;
+  for (int k=0; k<nWords; k++) {
+    uchar const *e = entry(k);
+    quint32 str = u32At(e);
+    quint32 len = u32At(e+4);
+    quint32 pst = u32At(e+8);
+    quint32 cnt = u32At(e+12);
+    if (str>nChars || len>nChars-str
+        || pst<prev || pst>nBytes || cnt>nBytes-pst)
+      return false;
+    prev = pst; // rawPostings relies on the order
+  }
+  qint64 fwdData = forwardOffset + qint64(nFwd)*forwardEntrySize;
+  qint64 nFwdBytes = size - fwdData;
+  for (int n=0; n<nFwd; n++) {
+    uchar const *e = base + forwardOffset + n*forwardEntrySize;
+    quint32 off = u32At(e+4);
+    quint32 cnt = u32At(e+8);
+    if (off>nFwdBytes || cnt>nFwdBytes-off)
+      return false;
+  }
+  return true;
+}
+
+void PostingFile::close() {
+  if (base && contents.isEmpty())
+    file.unmap((uchar *)base);
+  file.close();
+  contents.clear();
+  base = 0;
+  size = 0;
+  nWords = 0;
+  nPages = 0;
+  nFwd = 0;
+}
+
+uchar const *PostingFile::entry(int k) const {
+  return base + dictOffset + k*dictEntrySize;
+}
+
+QString PostingFile::word(int k) const {
+  uchar const *e = entry(k);
+  uchar const *s = base + stringsOffset + 2*u32At(e);
+  int len = u32At(e+4);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  return QString((QChar const *)s, len);
+#else
+  QString w(len, QChar());
+  for (int i=0; i<len; i++)
+    w[i] = QChar(qFromLittleEndian<quint16>(s + 2*i));
+  return w;
+#endif
+}
+
+int PostingFile::compare(int k, QString const &w) const {
+  // Like QString::compare(word(k), w), but without copying
+  uchar const *e = entry(k);
+  uchar const *s = base + stringsOffset + 2*u32At(e);
+  int len = u32At(e+4);
+  int n = qMin(len, w.size());
+  QChar const *wd = w.constData();
+  for (int i=0; i<n; i++) {
+    ushort a = qFromLittleEndian<quint16>(s + 2*i);
+    ushort b = wd[i].unicode();
+    if (a!=b)
+      return a<b ? -1 : 1;
+  }
+  return len - w.size();
+}
+
+bool PostingFile::startsWith(int k, QString const &prefix) const {
+  uchar const *e = entry(k);
+  uchar const *s = base + stringsOffset + 2*u32At(e);
+  int len = u32At(e+4);
+  int n = prefix.size();
+  if (len<n)
+    return false;
+  QChar const *pd = prefix.constData();
+  for (int i=0; i<n; i++)
+    if (qFromLittleEndian<quint16>(s + 2*i) != pd[i].unicode())
+      return false;
+  return true;
+}
+
+void PostingFile::prefixRange(QString prefix, int &begin, int &end) const {
+  /* Words with a common prefix are contiguous in the dictionary, so
+     two binary searches find them all. */
+  begin = lowerBound(prefix);
+  int lo = begin;
+  int hi = nWords;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (startsWith(mid, prefix))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  end = lo;
+}
+
+int PostingFile::lowerBound(QString w) const {
+  int lo = 0;
+  int hi = nWords;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (compare(mid, w)<0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+int PostingFile::find(QString w) const {
+  int k = lowerBound(w);
+  return (k<nWords && compare(k, w)==0) ? k : -1;
+}
+
+int PostingFile::postingCount(int k) const {
+  return u32At(entry(k)+12);
+}
+
+QVector<int> PostingFile::postings(int k) const {
+  uchar const *e = entry(k);
+  return decode(base + postingsOffset + u32At(e+8), base + lastseenOffset,
+                u32At(e+12));
+}
+
+QByteArray PostingFile::rawPostings(int k) const {
+  uchar const *e = entry(k);
+  quint32 start = u32At(e+8);
+  quint32 end = k+1<nWords ? u32At(entry(k+1)+8)
+    : lastseenOffset - postingsOffset;
+  return QByteArray((char const *)base + postingsOffset + start, end - start);
+}
+
+QMap<int, QDateTime> PostingFile::lastSeen() const {
+  QMap<int, QDateTime> ls;
+  uchar const *p = base + lastseenOffset;
+  for (int k=0; k<nPages; k++) {
+    int pg = qFromLittleEndian<qint32>(p);
+    qint64 ms = qFromLittleEndian<qint64>(p+4);
+    ls[pg] = QDateTime::fromMSecsSinceEpoch(ms);
+    p += lastseenEntrySize;
+  }
+  return ls;
+}
+
+int PostingFile::forwardPage(int n) const {
+  return qFromLittleEndian<qint32>(base + forwardOffset
+                                   + n*forwardEntrySize);
+}
+
+int PostingFile::findForward(int pg) const {
+  int lo = 0;
+  int hi = nFwd;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (forwardPage(mid)<pg)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (lo<nFwd && forwardPage(lo)==pg) ? lo : -1;
+}
+
+QVector<int> PostingFile::pageWords(int n) const {
+  uchar const *e = base + forwardOffset + n*forwardEntrySize;
+  uchar const *data = base + forwardOffset + nFwd*forwardEntrySize;
+  return decode(data + u32At(e+4), base + size, u32At(e+8));
+}
+
+void PostingFile::encode(QByteArray &dest, QVector<int> const &pages) {
+  int prev = 0;
+  for (int pg: pages) {
+    quint32 d = pg - prev;
+    prev = pg;
+    while (d>=0x80) {
+      dest.append(char(0x80 | (d & 0x7f)));
+      d >>= 7;
+    }
+    dest.append(char(d));
+  }
+}
+
+QVector<int> PostingFile::decode(uchar const *src, uchar const *end,
+                                 int count) {
+  QVector<int> pages;
+  if (count>end-src)
+    count = end-src;
+  pages.reserve(count);
+  int prev = 0;
+  for (int k=0; k<count; k++) {
+    quint32 d = 0;
+    int shift = 0;
+    uchar b;
+    do {
+      if (src>=end || shift>28) {
+        qDebug() << "PostingFile: corrupted posting list";
+        return pages;
+      }
+      b = *src++;
+      d |= quint32(b & 0x7f) << shift;
+      shift += 7;
+    } while (b & 0x80);
+    prev += d;
+    pages << prev;
+  }
+  return pages;
+}
+
+PostingFile::Writer::Writer() {
+  nWords = 0;
+  nFwd = 0;
+}
+
+int PostingFile::Writer::add(QString word, QVector<int> const &pages) {
+  QByteArray p;
+  encode(p, pages);
+  return addRaw(word, pages.size(), p);
+}
+
+void PostingFile::Writer::addPage(int pg, QVector<int> const &wordids) {
+  uchar b[4];
+  qToLittleEndian<qint32>(pg, b);
+  fwdTable.append((char const *)b, 4);
+  putU32(fwdTable, fwdData.size());
+  putU32(fwdTable, wordids.size());
+  encode(fwdData, wordids);
+  nFwd++;
+}
+
+int PostingFile::Writer::addRaw(QString word, int count,
+                                 QByteArray const &raw) {
+  putU32(dict, strings.size()/2);
+  putU32(dict, word.size());
+  putU32(dict, postings.size());
+  putU32(dict, count);
+  for (QChar c: word) {
+    uchar b[2];
+    qToLittleEndian<quint16>(c.unicode(), b);
+    strings.append((char const *)b, 2);
+  }
+  postings.append(raw);
+  return nWords++;
+}
+
+bool PostingFile::Writer::save(QString fn,
+                               QMap<int, QDateTime> const &lastseen) const {
+  QByteArray ls;
+  for (auto it=lastseen.begin(); it!=lastseen.end(); ++it) {
+    uchar b[12];
+    qToLittleEndian<qint32>(it.key(), b);
+    qToLittleEndian<qint64>(it.value().toMSecsSinceEpoch(), b+4);
+    ls.append((char const *)b, 12);
+  }
+  QByteArray hdr;
+  quint32 dictOffset = headerSize;
+  quint32 stringsOffset = dictOffset + dict.size();
+  quint32 postingsOffset = stringsOffset + strings.size();
+  quint32 lastseenOffset = postingsOffset + postings.size();
+  quint32 forwardOffset = lastseenOffset + ls.size();
+  putU32(hdr, postingMagic);
+  putU32(hdr, postingVersion);
+  putU32(hdr, nWords);
+  putU32(hdr, lastseen.size());
+  putU32(hdr, nFwd);
+  putU32(hdr, dictOffset);
+  putU32(hdr, stringsOffset);
+  putU32(hdr, postingsOffset);
+  putU32(hdr, lastseenOffset);
+  putU32(hdr, forwardOffset);
+
+  // The old file stays in place until the new one is complete
+  QSaveFile f(fn);
+  if (!f.open(QFile::WriteOnly)) {
+    qDebug() << "PostingFile: cannot write" << fn;
+    return false;
+  }
+  bool ok = f.write(hdr)==hdr.size()
+    && f.write(dict)==dict.size()
+    && f.write(strings)==strings.size()
+    && f.write(postings)==postings.size()
+    && f.write(ls)==ls.size()
+    && f.write(fwdTable)==fwdTable.size()
+    && f.write(fwdData)==fwdData.size();
+  if (ok)
+    ok = f.commit();
+  else
+    f.cancelWriting();
+  if (!ok)
+    qDebug() << "PostingFile: failed to save" << fn;
+  return ok;
+}
+
+#if 0
+// Round trip test and size comparison against the json format
+#include "WordIndex.h"
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QElapsedTimer>
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QMap< int, QSet<QString> > pages;
+  for (int w=0; w<100000; w++)
+    for (int k=0; k<1 + w%37; k++)
+      pages[(w*7 + k*13) % 5000 + 1] << QString("w%1é%2").arg(w).arg(w%97);
+  WordIndex idx;
+  for (auto i=pages.begin(); i!=pages.end(); ++i)
+    idx.rebuildEntry(i.key(), i.value());
+  idx.exportJSON("/tmp/index.json");
+  QElapsedTimer t;
+  t.start();
+  idx.save("/tmp/index.eli");
+  qDebug() << "Save:" << t.elapsed() << "ms";
+  qDebug() << "json:" << QFileInfo("/tmp/index.json").size()
+           << "compact:" << QFileInfo("/tmp/index.eli").size();
+
+  WordIndex a, b;
+  t.restart();
+  a.load("/tmp/index.json");
+  qDebug() << "Load json:" << t.elapsed() << "ms";
+  t.restart();
+  b.load("/tmp/index.eli");
+  qDebug() << "Load compact:" << t.elapsed() << "ms";
+  bool same = true;
+  for (int w=0; w<100000; w+=17) {
+    QString word = QString("w%1é%2").arg(w).arg(w%97);
+    same = same && a.findWord(word)==b.findWord(word);
+  }
+  same = same && a.findPartialWord("w12")==b.findPartialWord("w12");
+  for (int pg=1; pg<=5000; pg+=13)
+    same = same && a.pageWords(pg)==b.pageWords(pg);
+  b.dropEntry(1);
+  b.save("/tmp/index.eli");
+  b.load("/tmp/index.eli");
+  same = same && b.pageWords(1).isEmpty()
+    && !b.findWord(pages[1].values().first()).contains(1);
+  qDebug() << "Identical:" << same;
+  return 0;
+}
+#endif
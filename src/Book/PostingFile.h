@@ -0,0 +1,114 @@
+// Book/PostingFile.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PostingFile.H
+
+#ifndef POSTINGFILE_H
+
+#define POSTINGFILE_H
+
+#include <QString>
+#include <QVector>
+#include <QMap>
+#include <QDateTime>
+#include <QFile>
+
+class PostingFile {
+  /* Read-only access to a search index in compact binary form. The file
+     is mapped into memory; nothing is decoded until asked for.
+     Layout (all integers little-endian):
+       header: magic, version, word count, page count, number of pages
+               in the forward index, and the offsets of the five sections
+               that follow
+       dictionary: per word, in QString order: offset and length of its
+               text (in UTF-16 units), offset of its posting list (in
+               bytes), and the number of pages in that list
+       strings: the words, UTF-16LE, back to back
+       postings: per word, the sorted page numbers, delta encoded as
+               LEB128 varints
+       lastseen: per page, the page number and a time stamp in ms
+       forward: per page, in increasing order: the page number, offset
+               and length of its word list; followed by those lists,
+               each the sorted indices of the page's words in the
+               dictionary, delta encoded like the postings
+     Use PostingFile::Writer to create such files. */
+public:
+  PostingFile();
+  ~PostingFile();
+  bool open(QString fn);
+  /* Returns false if FN cannot be read or is not a posting file. */
+  void close();
+  bool isOpen() const { return base!=0; }
+  int wordCount() const { return nWords; }
+  QString word(int k) const;
+  int find(QString w) const; // index of word, or -1
+  int lowerBound(QString w) const; // index of first word >= w
+  void prefixRange(QString prefix, int &begin, int &end) const;
+  /* Sets BEGIN and END such that exactly the words with indices in
+     [BEGIN, END) start with PREFIX. */
+  int postingCount(int k) const;
+  QVector<int> postings(int k) const;
+  QByteArray rawPostings(int k) const; // still encoded
+  QMap<int, QDateTime> lastSeen() const;
+  int forwardCount() const { return nFwd; }
+  int forwardPage(int n) const; // page number of n-th forward entry
+  int findForward(int pg) const; // index of forward entry, or -1
+  QVector<int> pageWords(int n) const;
+  /* Dictionary indices of the words on the n-th page of the forward
+     index. */
+  static bool isPostingFile(QString fn);
+public:
+  class Writer {
+    /* Words must be added in increasing QString order; pages in
+       increasing numeric order. */
+  public:
+    Writer();
+    int add(QString word, QVector<int> const &pages);
+    int addRaw(QString word, int count, QByteArray const &postings);
+    /* Both return the index of the word in the dictionary. */
+    void addPage(int pg, QVector<int> const &wordids);
+    bool save(QString fn, QMap<int, QDateTime> const &lastseen) const;
+  private:
+    QByteArray dict;
+    QByteArray strings;
+    QByteArray postings;
+    QByteArray fwdTable;
+    QByteArray fwdData;
+    int nWords;
+    int nFwd;
+  };
+public:
+  static void encode(QByteArray &dest, QVector<int> const &pages);
+  static QVector<int> decode(uchar const *src, uchar const *end, int count);
+  /* Never reads at or beyond END; a list that would is cut short. */
+private:
+  uchar const *entry(int k) const;
+  bool checkEntries() const;
+  int compare(int k, QString const &w) const;
+  bool startsWith(int k, QString const &prefix) const;
+private:
+  QFile file;
+  QByteArray contents; // if the file could not be mapped
+  uchar const *base;
+  qint64 size;
+  int nWords;
+  int nPages;
+  int nFwd;
+  quint32 dictOffset, stringsOffset, postingsOffset, lastseenOffset;
+  quint32 forwardOffset;
+};
+
+#endif
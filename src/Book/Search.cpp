@@ -25,17 +25,38 @@
 #include "FootnoteData.h"
 #include "Index.h"
 #include "WordIndex.h"
+#include "PhraseIndex.h"
 #include "Assert.h"
 #include "LateNoteManager.h"
 
+#include "EntryFile.h"
+#include "EntryData.h"
+#include "TOC.h"
+#include "TOCEntry.h"
+#include "SaveScheduler.h"
+
 #include <QSet>
 #include <QDebug>
+#include <QTimer>
+#include <QtConcurrent>
 #include "TableData.h"
 
 Search::Search(Notebook *book): book(book) {
+  watcher = 0;
+  nPages = 0;
+  nextPage = 0;
+  abandon = false;
+  complete = false;
+  indexIncomplete = false;
+  firstMs = -1;
+  totalMs = -1;
+  batchTimer = new QTimer(this);
+  batchTimer->setSingleShot(true);
+  connect(batchTimer, SIGNAL(timeout()), SLOT(deliver()));
 }
 
 Search::~Search() {
+  abandonSearch();
 }
 
 QString Search::untable(TableData const *tbld) {
@@ -52,6 +73,21 @@ QString Search::untable(TableData const *tbld) {
   return res;
 }
 
+SearchResult::Type Search::resultType(Data const *data) {
+  if (dynamic_cast<TableBlockData const *>(data))
+    return SearchResult::InTableBlock;
+  else if (dynamic_cast<TextBlockData const *>(data))
+    return SearchResult::InTextBlock;
+  else if (dynamic_cast<LateNoteData const *>(data))
+    return SearchResult::InLateNote;
+  else if (dynamic_cast<GfxNoteData const *>(data))
+    return SearchResult::InGfxNote;
+  else if (dynamic_cast<FootnoteData const *>(data))
+    return SearchResult::InFootnote;
+  else
+    return SearchResult::Unknown;
+}
+
 void Search::addToResults(QList<SearchResult> &dest, QString phrase,
                           QString entryTitle,
                           Data const *data, int entryPage, int dataPage) {
@@ -61,20 +97,7 @@ void Search::addToResults(QList<SearchResult> &dest, QString phrase,
       // gotcha
       SearchResult res;
       res.phrase = phrase;
-      if (dynamic_cast<TableBlockData const *>(data))
-        res.type = SearchResult::InTableBlock;
-      else if (dynamic_cast<TextBlockData const *>(data))
-        res.type = SearchResult::InTextBlock;
-      else if (dynamic_cast<TextBlockData const *>(data))
-        res.type = SearchResult::InTextBlock;
-      else if (dynamic_cast<LateNoteData const *>(data))
-        res.type = SearchResult::InLateNote;
-      else if (dynamic_cast<GfxNoteData const *>(data))
-        res.type = SearchResult::InGfxNote;
-      else if (dynamic_cast<FootnoteData const *>(data))
-        res.type = SearchResult::InFootnote;
-      else
-        res.type = SearchResult::Unknown;
+      res.type = resultType(data);
       res.page = dataPage;
       res.startPageOfEntry = entryPage;
       res.entryTitle = entryTitle;
@@ -101,6 +124,10 @@ void Search::addToResults(QList<SearchResult> &dest, QString phrase,
 }
 
 QList<SearchResult> Search::immediatelyFindPhrase(QString phrase) const {
+  PhraseIndex const *pidx = book->index()->phrases();
+  if (pidx)
+    return pidx->findPhrase(phrase, book->toc());
+
   QStringList words = phrase.toLower().split(QRegExp("\\s+"));
   QSet<int> entries = book->index()->words()->findWords(words, true);
   QList<int> sortedEntries = entries.toList();
@@ -124,61 +151,159 @@ QList<SearchResult> Search::immediatelyFindPhrase(QString phrase) const {
   return results;
 }
 
-void Search::startSearchForPhrase(QString s) {
-  if (isRunning()) {
-    abandon = true;
-    if (!wait(2000)) {
-      qDebug() << "Search: could not stop thread nicely.";
-      terminate();
-    }
+struct SearchJob {
+  QString pagesDir;
+  int pgno;
+  QString uuid;
+  QString phrase;
+  QSharedPointer<QAtomicInt> stop;
+};
+
+QList<SearchResult> Search::searchPage(SearchJob const &job) {
+  /* Runs in a worker thread. Nothing here is shared with the notebook,
+     so the page objects are created, searched, and deleted right here.
+     They are loaded detached, so they never reach the SaveScheduler. */
+  QList<SearchResult> res;
+  if (job.stop->load())
+    return res;
+  EntryFile *f = ::loadEntryDetached(job.pagesDir, job.pgno, job.uuid);
+  if (!f) {
+    qDebug() << "Search: Cannot load" << job.pgno << job.uuid;
+    return res;
+  }
+  EntryData *ed = f->data();
+  QString ttl = ed->titleText();
+  foreach (TitleData const *bd, ed->children<TitleData>())
+    addToResults(res, job.phrase, ttl, bd, job.pgno, job.pgno);
+  foreach (BlockData const *bd, ed->children<BlockData>()) {
+    if (job.stop->load())
+      break;
+    addToResults(res, job.phrase, ttl, bd, job.pgno, job.pgno + bd->sheet());
+  }
+  if (!job.stop->load()) {
+    QString notes = f->fileName();
+    notes.replace(".json", ".notes");
+    LateNoteManager lnm(notes, 0, true);
+    foreach (LateNoteData const *bd, lnm.notes())
+      addToResults(res, job.phrase, ttl, bd, job.pgno,
+                   job.pgno + bd->sheet());
   }
+  delete f;
+  return res;
+}
+
+void Search::startSearchForPhrase(QString s) {
+  abandonSearch();
 
   phrase = s;
   results.clear();
+  pending.clear();
   abandon = false;
-  start();
+  complete = false;
+  nPages = 0;
+  nextPage = 0;
+  firstMs = -1;
+  totalMs = -1;
+  clock.start();
+  indexIncomplete = book->index()->words()->isBuilding();
+
+  PhraseIndex const *pidx = book->index()->phrases();
+  if (pidx) {
+    // Nothing needs to be loaded
+    pending = pidx->findPhrase(phrase, book->toc());
+    batchTimer->start(0);
+    return;
+  }
+
+  /* Pages are read from disk, so that is where they must be current.
+     While version control has saving blocked, we make do with what is
+     on disk rather than write underneath it. */
+  SaveScheduler::instance()->flushBarrier(false);
+
+  QStringList words = phrase.toLower().split(QRegExp("\\s+"));
+  QList<int> pages
+    = book->index()->words()->findWords(words, true).toList();
+  qSort(pages);
+  stop = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+  QList<SearchJob> jobs;
+  QString pagesDir = book->filePath("pages");
+  for (int pgno: pages) {
+    TOCEntry const *te = book->toc()->entries().value(pgno, 0);
+    if (!te)
+      continue;
+    SearchJob job;
+    job.pagesDir = pagesDir;
+    job.pgno = pgno;
+    job.uuid = te->uuid();
+    job.phrase = phrase;
+    job.stop = stop;
+    jobs << job;
+  }
+  nPages = jobs.size();
+  watcher = new QFutureWatcher< QList<SearchResult> >(this);
+  connect(watcher, SIGNAL(resultReadyAt(int)), SLOT(pageSearched()));
+  connect(watcher, SIGNAL(finished()), SLOT(pageSearched()));
+  watcher->setFuture(QtConcurrent::mapped(jobs, searchPage));
+}
+
+void Search::pageSearched() {
+  /* Results are collected in batches, so that the GUI is not swamped
+     with tiny updates. */
+  if (!batchTimer->isActive())
+    batchTimer->start(50);
+}
+
+void Search::deliver() {
+  QList<SearchResult> batch = pending;
+  pending.clear();
+  if (watcher) {
+    QFuture< QList<SearchResult> > future = watcher->future();
+    while (nextPage<nPages && future.isResultReadyAt(nextPage))
+      batch += future.resultAt(nextPage++);
+  }
+  if (!batch.isEmpty()) {
+    if (firstMs<0)
+      firstMs = clock.elapsed();
+    results += batch;
+    emit resultsFound(batch);
+  }
+  if (nextPage>=nPages && !complete) {
+    complete = true;
+    totalMs = clock.elapsed();
+    qDebug() << "Search: searched" << nPages << "pages."
+             << "First result after" << firstMs << "ms;"
+             << "complete after" << totalMs << "ms";
+    if (watcher) {
+      watcher->deleteLater();
+      watcher = 0;
+    }
+    emit searchCompleted();
+  }
 }
 
 void Search::abandonSearch() {
-  abandon = true;
+  if (isSearching())
+    abandon = true;
+  batchTimer->stop();
+  pending.clear();
+  if (stop)
+    stop->store(1);
+  if (watcher) {
+    watcher->disconnect(this);
+    watcher->cancel();
+    watcher->deleteLater(); // the future does not need its watcher
+    watcher = 0;
+  }
 }
 
 bool Search::isSearchComplete() {
-  return !isRunning() && !abandon;
+  return complete && !abandon;
 }
 
 bool Search::isSearching() {
-  return isRunning();
+  return !complete && !abandon && (watcher || batchTimer->isActive());
 }
 
 QList<SearchResult> Search::searchResults() const {
-  mutex.lock();
-  QList<SearchResult> res = results;
-  mutex.unlock();
-  return res;
-}
-
-      
-void Search::run() {
-  QStringList words = phrase.toLower().split(QRegExp("\\s+"));
-  QSet<int> entries = book->index()->words()->findWords(words, true);
-
-  foreach (int pgno, entries) {
-    if (abandon)
-      return;
-    CachedEntry ef(book->entry(pgno));
-    QString ttl = ef->titleText();
-    foreach (TitleData const *bd, ef->children<TitleData>()) {
-      mutex.lock();
-      addToResults(results, phrase, ttl, bd, pgno, pgno);
-      mutex.unlock();
-    }
-    foreach (BlockData const *bd, ef->children<BlockData>()) {
-      mutex.lock();
-      addToResults(results, phrase, ttl, bd, pgno, pgno + bd->sheet());
-      mutex.unlock();
-    }
-  }
-  if (!abandon)
-    emit searchCompleted();
+  return results;
 }
@@ -24,8 +24,11 @@
 #include <QString>
 #include <QDateTime>
 #include <QList>
-#include <QThread>
-#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 
 #include "Notebook.h"
 
@@ -49,7 +52,14 @@ struct SearchResult {
   QList<int> whereInContext;
 };
 
-class Search: public QThread {
+class Search: public QObject {
+  /* Full-text search. The synchronous immediatelyFindPhrase() goes
+     through the notebook's own entries. A search started with
+     startSearchForPhrase() runs on the global thread pool instead: each
+     candidate page is loaded from disk as a private, read-only snapshot
+     and searched independently. Results are delivered in batches, in
+     page order, through resultsFound(). If the positional index is
+     enabled, neither approach loads any pages. */
   Q_OBJECT;
 public:
   Search(Notebook *book);
@@ -57,23 +67,46 @@ public:
   QList<SearchResult> immediatelyFindPhrase(QString) const;
   void startSearchForPhrase(QString);
   void abandonSearch();
+  /* Returns immediately. Pages being searched at that moment are left
+     to finish in the background; their results are dropped. */
   bool isSearchComplete();
   bool isSearching();
-  QList<SearchResult> searchResults() const;
+  QList<SearchResult> searchResults() const; // everything found so far
+  QString currentPhrase() const { return phrase; }
+  qint64 msToFirstResult() const { return firstMs; } // -1 if none yet
+  qint64 msTotal() const { return totalMs; } // -1 if not complete
+  bool isIndexIncomplete() const { return indexIncomplete; }
+  /* True if the search index was still being built when the search
+     started, so that results may be missing. */
+  static SearchResult::Type resultType(Data const *container);
+  static QString untable(class TableData const *);
 signals:
+  void resultsFound(QList<SearchResult>);
   void searchCompleted();
+private slots:
+  void pageSearched();
+  void deliver();
 private:
   static void addToResults(QList<SearchResult> &dest, QString phrase,
                            QString entryTitle,
                            Data const *data, int entryPage, int dataPage);
-  void run();
-  static QString untable(class TableData const *);
+  static QList<SearchResult> searchPage(struct SearchJob const &);
 private:
   Notebook *book;
   QString phrase;
-  QList<SearchResult> results;
+  QList<SearchResult> results; // delivered
+  QList<SearchResult> pending; // found, but not yet delivered
+  QFutureWatcher< QList<SearchResult> > *watcher;
+  QSharedPointer<QAtomicInt> stop;
+  int nPages; // number of pages being searched
+  int nextPage; // index of next page whose results are to be delivered
   bool abandon;
-  mutable QMutex mutex;
+  bool complete;
+  bool indexIncomplete;
+  class QTimer *batchTimer;
+  QElapsedTimer clock;
+  qint64 firstMs;
+  qint64 totalMs;
 };
 
 #endif
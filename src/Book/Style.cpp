@@ -24,6 +24,7 @@
 #include <QColor>
 #include "JSONParser.h"
 #include "Assert.h"
+#include "StartupProfile.h"
 
 Style const &Style::defaultStyle() {
   static Style s;
@@ -48,6 +49,7 @@ Style::Style() {
 Style::Style(QString fn) {
   QFile f(fn);
   if (f.open(QFile::ReadOnly)) {
+    StartupProfile::countFile(f.size());
     QTextStream ts(&f);
     ts.setCodec("UTF-8");
     JSONParser p(ts.readAll());
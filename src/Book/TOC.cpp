@@ -26,7 +26,12 @@
 #include "TitleData.h"
 #include "Assert.h"
 #include <QProgressDialog>
+#include <QtConcurrent>
+#include <QEventLoop>
+#include <QFutureWatcher>
 #include "Catalog.h"
+#include "DataLoader.h"
+#include "PageRangeIndex.h"
 
 static Data::Creator<TOC> c("toc");
 
@@ -56,6 +61,7 @@ void TOC::loadMore(QVariantMap const &) {
   entries_.clear();
   foreach (TOCEntry *e, children<TOCEntry>()) 
     entries_[e->startPage()] = e;
+  ranges_.invalidate();
 }
 
 TOC::~TOC() {
@@ -70,54 +76,62 @@ TOCEntry *TOC::tocEntry(int startPage) const {
   return entries_[startPage];
 }
 
+PageRangeIndex const &TOC::ranges() const {
+  if (!ranges_.isValid())
+    ranges_.rebuild(entries_.values());
+  return ranges_;
+}
+
+void TOC::entryResized(TOCEntry *e) {
+  ranges_.resize(e);
+}
+
+void TOC::entryMoved(TOCEntry *) {
+  ranges_.invalidate();
+}
+
 TOCEntry *TOC::find(int page) const {
-  // This is not an efficient implementation, but it's fine for reasonably
-  // sized notebooks
-  TOCEntry *r = 0;
-  foreach (TOCEntry *e, entries_) 
-    if (e->contains(page))
-      r = e;
-  return r;
+  /* If ranges overlap, the entry that starts last wins. */
+  PageRangeIndex const &idx = ranges();
+  int k = idx.lastEndingAfter(idx.lastStartingBy(page), page);
+  return k<0 ? 0 : idx.at(k);
 }
 
 TOCEntry *TOC::find(QString page) const {
-  // This is not an efficient implementation, but it's fine for reasonably
-  // sized notebooks
-  TOCEntry *r = 0;
-  foreach (TOCEntry *e, entries_) 
-    if (e->contains(page))
-      r = e;
-  return r;
+  /* A page like "12b" is contained in an entry if both 12 and 14 are. */
+  QRegExp re("(\\d\\d*)([a-z]?)");
+  if (!re.exactMatch(page))
+    return 0;
+  int n = re.cap(1).toInt();
+  QString a = re.cap(2);
+  int m = a=="" ? n : n + 1 + a[0].unicode() - 'a';
+  PageRangeIndex const &idx = ranges();
+  int k = idx.lastEndingAfter(idx.lastStartingBy(n), m);
+  return k<0 ? 0 : idx.at(k);
 }
 
 TOCEntry *TOC::findBackward(int page) const {
-  TOCEntry *r = 0;
-  foreach (TOCEntry *e, entries_) 
-    if (e->startPage() <= page && (r==0 || e->startPage() > r->startPage()))
-      r = e;
-  return r;
+  EntryMap::const_iterator i = entries_.upperBound(page);
+  if (i==entries_.constBegin())
+    return 0;
+  --i;
+  return i.value();
 }
 
 TOCEntry *TOC::findForward(int page) const {
-  TOCEntry *r = 0;
-  foreach (TOCEntry *e, entries_) 
-    if (e->startPage()+e->sheetCount()-1 >= page
-        && (r==0 || e->startPage() < r->startPage()))
-      r = e;
-  return r;
+  PageRangeIndex const &idx = ranges();
+  int k = idx.firstEndingAfter(page);
+  return k<0 ? 0 : idx.at(k);
 }
-  
 
 TOCEntry *TOC::entryAfter(TOCEntry *te) const {
-  bool has = false;
-  /* Next magic returns first entry after match */
-  foreach (TOCEntry *e, entries_) {
-    if (has)
-      return e;
-    else if (e==te)
-      has = true;
-  }
-  return 0;
+  if (!te)
+    return 0;
+  EntryMap::const_iterator i = entries_.constFind(te->startPage());
+  if (i==entries_.constEnd() || i.value()!=te)
+    return 0;
+  ++i;
+  return i==entries_.constEnd() ? 0 : i.value();
 }
 
 TOCEntry *TOC::addEntry(EntryData *data) {
@@ -130,6 +144,7 @@ TOCEntry *TOC::addEntry(EntryData *data) {
   e->setModified(data->modified());
   e->setLastSeen(QDateTime::currentDateTime());
   entries_[e->startPage()] = e;
+  ranges_.invalidate();
   return e;
 }
 
@@ -162,6 +177,7 @@ bool TOC::deleteEntry(TOCEntry *e) {
     return false;
   int p = e->startPage();
   if (entries_.remove(p)) {
+    ranges_.invalidate();
     Data::deleteChild(e);
     return true;
   } else {
@@ -260,31 +276,95 @@ bool TOC::update(Catalog const &cat) {
 
 static bool quickRead(QString fn,
 		      int &pgno, QString &uuid, QDateTime &date) {
-  QFile f(fn);
-  if (!f.open(QFile::ReadOnly))
+  bool ok;
+  QVariantMap hdr = DataLoader::readHeader(fn, &ok);
+  if (!ok || !hdr.contains("mod") || !hdr.contains("startPage")
+      || !hdr.contains("uuid"))
     return false;
-  char buffer[100];
-  QRegExp re1(": *\"(.*)\"");
-  QRegExp re2(": (\\d+)");
-  int n = 0;
-  while (n<3 && f.readLine(buffer, 100)>0) {
-    QString line(buffer);
-    if (line.indexOf("\"mod\"")>=0 && re1.indexIn(line)) {
-      date = QVariant(re1.cap(1)).toDateTime();
-      n++;
-    } else if (line.indexOf("\"startPage\"")>=0 && re2.indexIn(line)) {
-      pgno = re2.cap(1).toInt();
-      n++;
-    } else if (line.indexOf("\"uuid\"")>=0 && re1.indexIn(line)) {
-      uuid = re1.cap(1);
-      n++;
-    } else if (line.indexOf("\"cc\"")>=0) {
-      return true;
+  date = hdr["mod"].toDateTime();
+  pgno = hdr["startPage"].toInt();
+  uuid = hdr["uuid"].toString();
+  return true;
+}
+
+
+struct PageHeader {
+  PageHeader(): ok(false), pgno(0) { }
+  bool ok;
+  int pgno;
+  QString uuid;
+  QDateTime date;
+};
+
+static PageHeader readPageHeader(QString const &fn) {
+  // Runs in a worker thread
+  PageHeader h;
+  h.ok = quickRead(fn, h.pgno, h.uuid, h.date);
+  return h;
+}
+
+struct PageJob {
+  PageJob(): pgno(0), byName(false) { }
+  PageJob(QString fn, int pgno): path(fn), pgno(pgno), byName(true) { }
+  PageJob(QString dir, int pgno, QString uuid):
+    path(dir), pgno(pgno), uuid(uuid), byName(false) { }
+  QString path; // file name if byName, else pages folder
+  int pgno;
+  QString uuid;
+  bool byName;
+};
+
+static EntryFile *loadPage(PageJob const &job) {
+  /* Runs in a worker thread. The result is handed over to the GUI
+     thread, where it must be attached before it is used. */
+  EntryFile *f = job.byName
+    ? EntryFile::loadDetached(job.path)
+    : ::loadEntryDetached(job.path, job.pgno, job.uuid);
+  if (f)
+    f->moveToThread(QCoreApplication::instance()->thread());
+  return f;
+}
+
+template <typename T> class ResultWaiter {
+  /* Keeps the GUI alive while results come in, by running an event loop
+     that the future's watcher and the dialog's cancel button quit. */
+public:
+  ResultWaiter(QFuture<T> &future, QProgressDialog &mb):
+    future(future), mb(mb) {
+    watcher.setFuture(future);
+  }
+  bool waitFor(int k) {
+    /* Returns once the K-th result is in. Returns false, with the
+       remaining work canceled, if the user cancels. */
+    while (!future.isResultReadyAt(k)) {
+      if (mb.wasCanceled() || future.isFinished()) {
+        future.cancel();
+        future.waitForFinished();
+        return false;
+      }
+      QEventLoop loop;
+      QObject::connect(&watcher, SIGNAL(resultReadyAt(int)),
+                       &loop, SLOT(quit()));
+      QObject::connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+      QObject::connect(&mb, SIGNAL(canceled()), &loop, SLOT(quit()));
+      loop.exec();
     }
+    return true;
   }
-  return n>=3;
-}
+private:
+  QFuture<T> &future;
+  QProgressDialog &mb;
+  QFutureWatcher<T> watcher;
+};
 
+static void discardPages(QFuture<EntryFile *> &future, int k, int n) {
+  // Deletes pages loaded in advance of need, from K onward
+  future.cancel();
+  future.waitForFinished();
+  for (; k<n; k++)
+    if (future.isResultReadyAt(k))
+      delete future.resultAt(k);
+}
 
 bool TOC::doUpdate(Catalog const &cat,
                    QList<int> const &outdated_or_missing_page_in_index,
@@ -300,39 +380,58 @@ bool TOC::doUpdate(Catalog const &cat,
   QMap<int, QString> entryUuid;
   QDir pages(cat.path());
 
+  /* Headers are read on a worker pool; the results are checked in order
+     on the GUI thread, so the outcome is the same as reading them one
+     by one. */
+  QStringList fns;
+  foreach (int pgno, outdated_or_missing_page_in_index)
+    fns << pages.absoluteFilePath(*cat.pageToFileMap().find(pgno));
+  QFuture<PageHeader> headers = QtConcurrent::mapped(fns, readPageHeader);
+  ResultWaiter<PageHeader> headerWaiter(headers, mb);
+
   int k = 0;
   foreach (int pgno, outdated_or_missing_page_in_index) {
-    if (mb.wasCanceled()) 
+    if (!headerWaiter.waitFor(k))
       return false;
 
     QString fn = *cat.pageToFileMap().find(pgno);
     QRegExp re("^(\\d\\d*)-(.*).json");
     QString namedid = re.exactMatch(fn) ? re.cap(2) : "";
-    int storedpgno = 0;
-    QString storeduuid;
-    QDateTime storeddate;
-    if (!quickRead(pages.absoluteFilePath(fn),
-		   storedpgno, storeduuid, storeddate)
-	|| storedpgno!=pgno || storeduuid!=namedid) {
+    PageHeader h = headers.resultAt(k);
+    if (!h.ok || h.pgno!=pgno || h.uuid!=namedid) {
+      headers.cancel();
+      headers.waitForFinished();
       mb.close();
       reportMismatch(QStringList(), missing_from_index,
                      QStringList(), QStringList());
       return false;
     }
     if (!entries_.contains(pgno)
-	|| storeddate > entries_[pgno]->lastSeen()) 
-      entryUuid[pgno] = storeduuid;
+	|| h.date > entries_[pgno]->lastSeen()) 
+      entryUuid[pgno] = h.uuid;
     mb.setValue(++k);
   }
   mb.setMaximum(k + entryUuid.size());
-  for (int pgno: entryUuid.keys()) {
-    EntryFile *f = ::loadEntry(cat.path(), pgno, entryUuid[pgno], 0);
+
+  QList<PageJob> jobs;
+  for (int pgno: entryUuid.keys())
+    jobs << PageJob(cat.path(), pgno, entryUuid[pgno]);
+  QFuture<EntryFile *> files = QtConcurrent::mapped(jobs, loadPage);
+  ResultWaiter<EntryFile *> fileWaiter(files, mb);
+  for (int j=0; j<jobs.size(); j++) {
+    if (!fileWaiter.waitFor(j)) {
+      discardPages(files, j, jobs.size());
+      return false;
+    }
+    int pgno = jobs[j].pgno;
+    EntryFile *f = files.resultAt(j);
     if (f) {
+      ::attachEntry(f);
       if (!updateEntry(f->data()))
 	addEntry(f->data());
       delete f;
     } else {
-      delete f;
+      discardPages(files, j+1, jobs.size());
       errorReturn(QString("Failed to load %1-%2.")
 		  .arg(pgno).arg(entryUuid[pgno]));
     }
@@ -479,26 +578,41 @@ TOC *TOC::rebuild(QDir pages) {
 
   mb.setMaximum(pg2file.keys().size());
   int k = 0;
-  
-  foreach (int n, pg2file.keys()) {
-    if (mb.wasCanceled()) 
-      return 0;
 
+  /* Pages are loaded on a worker pool, but everything else happens here,
+     in page order, exactly as if they had been loaded one by one. */
+  QList<int> pgnos = pg2file.keys();
+  QList<PageJob> jobs;
+  foreach (int n, pgnos) {
     if (pg2file.count(n)>1) 
       errorReturn("Duplicate page number: " + QString::number(n));
-   
+    jobs << PageJob(pages.absoluteFilePath(*pg2file.find(n)), n);
+  }
+  QFuture<EntryFile *> files = QtConcurrent::mapped(jobs, loadPage);
+  ResultWaiter<EntryFile *> fileWaiter(files, mb);
+  
+  for (int j=0; j<jobs.size(); j++) {
+    if (!fileWaiter.waitFor(j)) {
+      discardPages(files, j, jobs.size());
+      delete toc;
+      return 0;
+    }
+
+    int n = pgnos[j];
     QString fn = *pg2file.find(n);
-    EntryFile *f = EntryFile::load(pages.absoluteFilePath(fn), 0);
+    EntryFile *f = files.resultAt(j);
     if (!f) {
       QFile fd(pages.absoluteFilePath(fn));
       QFileInfo fi(fd);
       if (fi.exists() && fi.size()>0) {
+        discardPages(files, j+1, jobs.size());
 	return errorReturn("Failed to load " + fn + ".");
       } else {
 	fd.remove();
 	continue;
       }
     }
+    f->attach();
     bool mustsave = false;
     int m = f->data()->startPage();
     if (m!=n) {
@@ -543,3 +657,49 @@ QDateTime TOC::latestMod() const {
       d = e->modified();
   return d;
 }
+
+#if 0
+// Test: parallel TOC::rebuild must match loading pages one by one
+#include <QApplication>
+
+static QVariantMap stripTimes(QVariantMap v) {
+  // Drop the fields that record when the TOC was built
+  v.remove("mod");
+  v.remove("seen");
+  if (v.contains("cc")) {
+    QVariantList cc;
+    for (QVariant c: v["cc"].toList())
+      cc << stripTimes(c.toMap());
+    v["cc"] = cc;
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  QApplication app(argc, argv);
+  if (argc<2) {
+    qDebug() << "Usage: tocrebuildtest notebook.nb";
+    return 2;
+  }
+  QDir pages(QDir(argv[1]).filePath("pages"));
+  TOC *par = TOC::rebuild(pages);
+  if (!par)
+    return 1;
+
+  TOC seq;
+  QMultiMap<int, QString> pg2file = Catalog(pages.absolutePath())
+    .pageToFileMap();
+  foreach (int n, pg2file.keys()) {
+    EntryFile *f = EntryFile::load(pages.absoluteFilePath(*pg2file.find(n)));
+    if (f) {
+      seq.addEntry(f->data());
+      delete f;
+    }
+  }
+
+  bool same = stripTimes(par->save())==stripTimes(seq.save());
+  qDebug() << "Entries:" << par->entries().size() << "Identical:" << same;
+  delete par;
+  return same ? 0 : 1;
+}
+#endif
@@ -26,6 +26,7 @@
 #include "Data.h"
 #include "DataFile.h"
 #include "TOCEntry.h"
+#include "PageRangeIndex.h"
 #include <QDir>
 
 class TOC: public Data {
@@ -37,7 +38,8 @@ public:
   TOCEntry *tocEntry(int startPage) const; // assertion if not found
   TOCEntry *find(int page) const;
   TOCEntry *find(QString page) const;
-  /* Returns entry containing the page page or 0 if none does. */
+  /* Returns entry containing the page page or 0 if none does.
+     Lookups by page take O(log n). */
   TOCEntry *findUUID(QString uuid) const; // 0 if none
   TOCEntry *findForward(int page) const;
   /* Returns entry containing the given page or the first entry that
@@ -99,9 +101,14 @@ private: // hide these from general use
   bool deleteChild(Data *);
   Data *takeChild(Data *);
   TOCEntry const *lastEntry() const;
+  PageRangeIndex const &ranges() const; // rebuilt if needed
+  friend class TOCEntry;
+  void entryResized(TOCEntry *); // called by TOCEntry::setSheetCount
+  void entryMoved(TOCEntry *); // called by TOCEntry::setStartPage
 private:
   typedef QMap<int, TOCEntry *> EntryMap;
   EntryMap entries_;
+  mutable PageRangeIndex ranges_;
   Notebook *nb;
 };
 
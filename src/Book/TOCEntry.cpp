@@ -17,6 +17,7 @@
 // TOCEntry.C
 
 #include "TOCEntry.h"
+#include "TOC.h"
 #include <QDebug>
 
 static Data::Creator<TOCEntry> c("entry");
@@ -76,7 +77,12 @@ QDateTime TOCEntry::lastSeen() const {
 }
 
 void TOCEntry::setStartPage(int n) {
+  bool moved = n!=startPage_;
   startPage_ = n;
+  // As in setSheetCount, the tree must be current first
+  TOC *toc = dynamic_cast<TOC *>(parent());
+  if (toc && moved)
+    toc->entryMoved(this);
   markModified();
 }
 
@@ -87,6 +93,10 @@ void TOCEntry::setTitle(QString t) {
 
 void TOCEntry::setSheetCount(int n) {
   sheetCount_ = n;
+  // The tree must be current before anyone hears of the modification
+  TOC *toc = dynamic_cast<TOC *>(parent());
+  if (toc)
+    toc->entryResized(this);
   markModified();
 }
 
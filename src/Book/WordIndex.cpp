@@ -19,23 +19,54 @@
 #include "TOC.h"
 #include "EntryFile.h"
 #include "EntryData.h"
+#include "DataLoader.h"
 #include "JSONFile.h"
+#include "PostingFile.h"
 #include "Assert.h"
 #include "Translate.h"
 #include <QDebug>
+#include <QHash>
 #include <QMessageBox>
-#include <QProgressDialog>
+#include <QtConcurrent>
 #include "LateNoteManager.h"
+#include <algorithm>
+#include <queue>
 
 WordIndex::WordIndex(QObject *parent): QObject(parent) {
+  base = new PostingFile();
+  watcher = 0;
+  nMerged = 0;
 }
 
 WordIndex::~WordIndex() {
+  if (watcher) {
+    watcher->cancel();
+    watcher->waitForFinished();
+  }
+  delete base;
 }
 
-/* Index is saved in json as a map from words to an array of integers. */
+void WordIndex::clear() {
+  base->close();
+  basefn = "";
+  overlay.clear();
+  fwdOverlay.clear();
+}
 
 bool WordIndex::load(QString filename) {
+  if (!PostingFile::isPostingFile(filename))
+    return loadJSON(filename);
+  clear();
+  if (!base->open(filename))
+    return false;
+  basefn = filename;
+  lastseen = base->lastSeen();
+  return true;
+}
+
+/* The older format is json: a map from words to an array of integers. */
+
+bool WordIndex::loadJSON(QString filename) {
   bool ok;
   QVariantMap idx = JSONFile::load(filename, &ok);
   if (!ok)
@@ -59,30 +90,101 @@ bool WordIndex::load(QString filename) {
 }
 
 void WordIndex::buildIndex(QVariantMap const &idx) {
-  index.clear();
+  clear();
 
   for (auto i = idx.begin(); i!=idx.end(); i++) {
     QString w = i.key();
     QVariantList lst = i.value().toList();
     for (QVariantList::iterator j = lst.begin(); j!=lst.end(); j++) {
       int pg = (*j).toInt();
-      index[w].insert(pg);
+      addPosting(w, pg);
+      fwdOverlay[pg].insert(w);
     }
   }
 }
 
 bool WordIndex::save(QString filename) {
+  /* Merges the overlays into the base. Unchanged posting lists are
+     copied without decoding. Words whose lists have become empty are
+     left out, so their dictionary indices change; REMAP keeps track. */
+  PostingFile::Writer writer;
+  int N = base->wordCount();
+  QVector<int> remap(N, -1);
+  QHash<QString, int> newids;
+  int k = 0;
+  auto i = overlay.constBegin();
+  while (k<N || i!=overlay.constEnd()) {
+    if (i==overlay.constEnd() || (k<N && base->word(k) < i.key())) {
+      remap[k] = writer.addRaw(base->word(k), base->postingCount(k),
+                               base->rawPostings(k));
+      k++;
+    } else {
+      int id = -1;
+      if (!i.value().isEmpty())
+        id = newids[i.key()] = writer.add(i.key(), i.value());
+      if (k<N && base->word(k)==i.key())
+        remap[k++] = id;
+      ++i;
+    }
+  }
+
+  int F = base->forwardCount();
+  int n = 0;
+  auto j = fwdOverlay.constBegin();
+  while (n<F || j!=fwdOverlay.constEnd()) {
+    if (j==fwdOverlay.constEnd()
+        || (n<F && base->forwardPage(n) < j.key())) {
+      QVector<int> ids;
+      for (int id: base->pageWords(n))
+        if (remap[id]>=0)
+          ids << remap[id]; // remapping preserves order
+      writer.addPage(base->forwardPage(n), ids);
+      n++;
+    } else {
+      if (n<F && base->forwardPage(n)==j.key())
+        n++;
+      if (!j.value().isEmpty()) {
+        QVector<int> ids;
+        for (QString w: j.value()) {
+          int id = newids.value(w, -1);
+          if (id<0) {
+            int kb = base->find(w);
+            if (kb>=0)
+              id = remap[kb];
+          }
+          if (id>=0)
+            ids << id;
+        }
+        std::sort(ids.begin(), ids.end());
+        writer.addPage(j.key(), ids);
+      }
+      ++j;
+    }
+  }
+
+  // The base must not be mapped while we replace it
+  base->close();
+  bool ok = writer.save(filename, lastseen);
+  if (ok && base->open(filename)) {
+    basefn = filename;
+    overlay.clear();
+    fwdOverlay.clear();
+  } else if (!basefn.isEmpty() && !base->open(basefn)) {
+    qDebug() << "WordIndex: Could not reopen" << basefn;
+  }
+  return ok;
+}
+
+bool WordIndex::exportJSON(QString filename) const {
   QVariantMap idx;
-  for (auto i = index.begin(); i!=index.end(); i++) {
-    QString w = i.key();
+  for (QString w: words()) {
     QVariantList lst;
-    foreach (int n, i.value())
+    for (int n: postings(w))
       lst.append(QVariant(n));
     idx[w] = QVariant(lst);
   }
 
   QVariantMap ls;
-  // qDebug() << "Saving index. sizeof lastseen is" << lastseen.size();
   for (auto i=lastseen.begin(); i!=lastseen.end(); i++) {
     int pgno = i.key();
     QDateTime dt = i.value();
@@ -97,84 +199,193 @@ bool WordIndex::save(QString filename) {
   return JSONFile::save(top, filename, true);
 }
 
-bool WordIndex::build(class TOC *toc, QString pagesDir) {
-  QProgressDialog mb("Search index found missing or corrupted."
-                     " Rebuilding...", "Cancel",
-                     0, toc->newPageNumber());
-  mb.setWindowModality(Qt::WindowModal);
-  mb.setMinimumDuration(200);
-  mb.setValue(0);
-  
-  index.clear();
-  QStringList warns;
-  foreach (int pg, toc->entries().keys()) {
-    if (mb.wasCanceled())
-      return false;
-    QString uuid = toc->tocEntry(pg)->uuid();
-    EntryFile *f = ::loadEntry(pagesDir, pg, uuid, 0);
-    if (f) {
-      Entry *entry = new Entry(f);
-      entry->lateNoteManager()->ensureLoaded();
-      for (QString w: entry->wordSet())
-        index[w].insert(pg);
-      delete entry;
+QStringList WordIndex::words() const {
+  QStringList res;
+  int N = base->wordCount();
+  int k = 0;
+  auto i = overlay.constBegin();
+  while (k<N || i!=overlay.constEnd()) {
+    if (i==overlay.constEnd() || (k<N && base->word(k) < i.key())) {
+      res << base->word(k++);
     } else {
-      qDebug() << "WordIndex::build - Cannot load entry" << pg << uuid;
-      warns << QString("%1").arg(pg);
+      if (k<N && base->word(k)==i.key())
+        k++;
+      if (!i.value().isEmpty())
+        res << i.key();
+      ++i;
     }
-    lastseen[pg] = QDateTime::currentDateTime();
-    qDebug() << "lastseen " << pg << lastseen[pg];
-    mb.setValue(pg);
-  } 
-  mb.close();
-  if (!warns.isEmpty())
-    QMessageBox::warning(0, Translate::_("eln"),
-                         "The following pages could not be loaded"
-                         " while rebuilding the search index: "
-                         + warns.join(", ") + ".", QMessageBox::Close);
+  }
+  return res;
+}
+
+QVector<int> WordIndex::postings(QString word) const {
+  auto i = overlay.constFind(word);
+  if (i!=overlay.constEnd())
+    return i.value();
+  int k = base->find(word);
+  return k>=0 ? base->postings(k) : QVector<int>();
+}
+
+QVector<int> &WordIndex::editable(QString word) {
+  auto i = overlay.find(word);
+  if (i!=overlay.end())
+    return i.value();
+  return overlay[word] = postings(word);
+}
+
+QSet<QString> WordIndex::pageWords(int startPage) const {
+  auto i = fwdOverlay.constFind(startPage);
+  if (i!=fwdOverlay.constEnd())
+    return i.value();
+  QSet<QString> words;
+  int n = base->findForward(startPage);
+  if (n>=0)
+    for (int id: base->pageWords(n))
+      words.insert(base->word(id));
+  return words;
+}
+
+void WordIndex::addPosting(QString word, int pg) {
+  QVector<int> &lst = editable(word);
+  auto i = std::lower_bound(lst.begin(), lst.end(), pg);
+  if (i==lst.end() || *i!=pg)
+    lst.insert(i, pg);
+}
+
+void WordIndex::removePosting(QString word, int pg) {
+  QVector<int> &lst = editable(word);
+  auto i = std::lower_bound(lst.begin(), lst.end(), pg);
+  if (i!=lst.end() && *i==pg)
+    lst.erase(i);
+  if (lst.isEmpty() && base->find(word)<0)
+    overlay.remove(word); // no need for a tombstone
+}
+
+bool WordIndex::rebuildEntry(int startPage, QSet<QString> newset) {
+  if (watcher)
+    touched << startPage;
+  return setPageWords(startPage, newset);
+}
+
+bool WordIndex::setPageWords(int startPage, QSet<QString> newset) {
+  lastseen[startPage] = QDateTime::currentDateTime();
+
+  QSet<QString> oldset = pageWords(startPage);
+  if (oldset==newset)
+    return false;
+  QSet<QString> dropped = oldset - newset;
+  QSet<QString> added = newset - oldset;
+  foreach (QString w, dropped)
+    removePosting(w, startPage);
+  foreach (QString w, added)
+    addPosting(w, startPage);
+  fwdOverlay[startPage] = newset;
   return true;
 }
 
-void WordIndex::rebuildEntry(int startPage, QSet<QString> newset,
-                             QSet<QString> *oldset) {
+bool WordIndex::updateEntry(int startPage, QSet<QString> const &added,
+                            QSet<QString> const &removed) {
+  if (watcher)
+    touched << startPage;
   lastseen[startPage] = QDateTime::currentDateTime();
-  
-  if (oldset) {
-    QSet<QString> dropped = *oldset - newset;
-    QSet<QString> added = newset - *oldset;
-    foreach (QString w, dropped) {
-      index[w].remove(startPage);
-      if (index[w].isEmpty())
-        index.remove(w);
+  if (added.isEmpty() && removed.isEmpty())
+    return false;
+  auto i = fwdOverlay.find(startPage);
+  if (i==fwdOverlay.end())
+    i = fwdOverlay.insert(startPage, pageWords(startPage));
+  QSet<QString> &words = i.value();
+  bool changed = false;
+  for (QString const &w: removed) {
+    if (words.remove(w)) {
+      removePosting(w, startPage);
+      changed = true;
     }
-    foreach (QString w, added)
-      index[w].insert(startPage);
-  } else {
-    dropEntry(startPage);
-    for (QString w: newset)
-      index[w].insert(startPage);
   }
+  for (QString const &w: added) {
+    if (!words.contains(w)) {
+      words.insert(w);
+      addPosting(w, startPage);
+      changed = true;
+    }
+  }
+  return changed;
 }
 
 void WordIndex::dropEntry(int startPage) {
+  if (watcher)
+    touched << startPage;
   lastseen.remove(startPage);
-  for (QSet<int> &set: index)
-    set.remove(startPage);
+  for (QString w: pageWords(startPage))
+    removePosting(w, startPage);
+  if (base->findForward(startPage)>=0)
+    fwdOverlay[startPage] = QSet<QString>();
+  else
+    fwdOverlay.remove(startPage);
+}
+
+static QSet<int> toSet(QVector<int> const &lst) {
+  QSet<int> s;
+  s.reserve(lst.size());
+  for (int pg: lst)
+    s.insert(pg);
+  return s;
 }
 
 QSet<int> WordIndex::findWord(QString word) {
-  if (index.contains(word))
-    return index[word];
-  else
-    return QSet<int>();
+  return toSet(postings(word));
+}
+
+static QVector<int> mergeSorted(QList< QVector<int> > const &lists) {
+  /* K-way merge of sorted lists into a single sorted list without
+     duplicates. */
+  if (lists.isEmpty())
+    return QVector<int>();
+  if (lists.size()==1)
+    return lists.first();
+  typedef std::pair<int, int> Head; // value, list index
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heap;
+  QVector<int> pos(lists.size(), 0);
+  int total = 0;
+  for (int k=0; k<lists.size(); k++) {
+    total += lists[k].size();
+    if (!lists[k].isEmpty())
+      heap.push(Head(lists[k][0], k));
+  }
+  QVector<int> res;
+  res.reserve(total);
+  while (!heap.empty()) {
+    Head h = heap.top();
+    heap.pop();
+    if (res.isEmpty() || res.last()!=h.first)
+      res << h.first;
+    int k = h.second;
+    if (++pos[k] < lists[k].size())
+      heap.push(Head(lists[k][pos[k]], k));
+  }
+  return res;
+}
+
+QVector<int> WordIndex::pagesWithPrefix(QString wordbit) const {
+  QList< QVector<int> > lists;
+  QSet<int> shadowed; // base words that the overlay replaces
+  for (auto i = overlay.lowerBound(wordbit);
+       i!=overlay.end() && i.key().startsWith(wordbit); ++i) {
+    if (!i.value().isEmpty())
+      lists << i.value();
+    int k = base->find(i.key());
+    if (k>=0)
+      shadowed.insert(k);
+  }
+  int begin, end;
+  base->prefixRange(wordbit, begin, end);
+  for (int k=begin; k<end; k++)
+    if (!shadowed.contains(k))
+      lists << base->postings(k);
+  return mergeSorted(lists);
 }
 
 QSet<int> WordIndex::findPartialWord(QString wordbit) {
-  QSet<int> s;
-  for (auto i = index.begin(); i!=index.end(); ++i)
-    if (i.key().startsWith(wordbit))
-      s |= i.value();
-  return s;
+  return toSet(pagesWithPrefix(wordbit));
 }
 
 QSet<int> WordIndex::findWords(QStringList words, bool lastPartial) {
@@ -194,50 +405,201 @@ QSet<int> WordIndex::findWords(QStringList words, bool lastPartial) {
   return s;
 }
 
+struct IndexJob {
+  QString pagesDir;
+  int pgno;
+  QString uuid;
+  QDateTime seen; // invalid if never indexed
+};
+
+struct PageWords {
+  PageWords(): pgno(0), ok(false), unchanged(false) { }
+  int pgno;
+  bool ok;
+  bool unchanged; // page is no newer than our index of it
+  QSet<QString> words;
+};
+
+static PageWords indexPage(IndexJob const &job) {
+  /* Runs in a worker thread. The page is loaded privately and deleted
+     right here; only its words are handed back. */
+  PageWords res;
+  res.pgno = job.pgno;
+  QString fn = ::entryFileName(job.pagesDir, job.pgno, job.uuid);
+  if (job.seen.isValid()) {
+    /* The TOC thinks the page is newer than our index of it. Check the
+       page's own header before going to the expense of loading it. */
+    bool ok;
+    QVariantMap hdr = DataLoader::readHeader(fn, &ok);
+    if (ok && hdr["uuid"].toString()==job.uuid
+        && hdr["mod"].toDateTime()<=job.seen.addSecs(10)) {
+      res.ok = true;
+      res.unchanged = true;
+      return res;
+    }
+  }
+  // Loaded detached, so that nothing here reaches the SaveScheduler
+  EntryFile *f = ::loadEntryDetached(job.pagesDir, job.pgno, job.uuid);
+  if (!f)
+    return res;
+  res.words = f->data()->wordSet();
+  QString notes = f->fileName();
+  notes.replace(".json", ".notes");
+  LateNoteManager lnm(notes, 0, true);
+  lnm.ensureLoaded();
+  res.words |= lnm.wordSet();
+  delete f;
+  res.ok = true;
+  return res;
+}
+
+void WordIndex::build(TOC const *toc, QString pagesDir) {
+  clear();
+  startJobs(toc, pagesDir, true);
+}
+
 bool WordIndex::update(TOC const *toc, QString pagesDir) {
-  QList<TOCEntry const *> todo;
+  startJobs(toc, pagesDir, false);
+  return isBuilding();
+}
+
+void WordIndex::startJobs(TOC const *toc, QString pagesDir, bool all) {
+  if (watcher) {
+    watcher->cancel();
+    waitForBuild();
+  }
+  QList<IndexJob> jobs;
   for (TOCEntry const *entry: toc->entries()) {
     int pg = entry->startPage();
-    QDateTime mod = entry->modified();
-    if (!lastseen.contains(pg) || mod>lastseen[pg].addSecs(10))
-      todo << entry;
+    bool seen = !all && lastseen.contains(pg);
+    if (seen && entry->modified()<=lastseen[pg].addSecs(10))
+      continue;
+    IndexJob job;
+    job.pagesDir = pagesDir;
+    job.pgno = pg;
+    job.uuid = entry->uuid();
+    if (seen)
+      job.seen = lastseen[pg];
+    jobs << job;
   }
-  
-  if (todo.isEmpty())
-    return false;
+  if (jobs.isEmpty())
+    return;
 
-  QProgressDialog mb("Updating search index...", "Cancel",
-                     0, todo.size());
-  mb.setWindowModality(Qt::WindowModal);
-  mb.setMinimumDuration(200);
+  qDebug() << "WordIndex: indexing" << jobs.size() << "pages";
+  buildTime.start();
+  merged = QVector<bool>(jobs.size(), false);
+  nMerged = 0;
+  touched.clear();
+  warns.clear();
+  watcher = new QFutureWatcher<PageWords>(this);
+  connect(watcher, SIGNAL(resultReadyAt(int)), SLOT(pageIndexed(int)));
+  connect(watcher, SIGNAL(finished()), SLOT(buildFinished()));
+  watcher->setFuture(QtConcurrent::mapped(jobs, indexPage));
+}
 
-  int k = 0;
-  QStringList warns;
-  for (TOCEntry const *entry: todo) {
-    if (mb.wasCanceled())
-      return k>0;
-    int pgno = entry->startPage();
-    QString uuid = entry->uuid();
-    EntryFile *f = ::loadEntry(pagesDir, pgno, uuid, 0);
-    if (f) {
-      for (QString w: f->data()->wordSet())
-        index[w].insert(pgno);
-      delete f;
-      lastseen[pgno] = QDateTime::currentDateTime();
-    } else {
-      qDebug() << "WordIndex::update - Cannot load entry" << pgno << uuid;
-      warns << QString("%1").arg(pgno);
-    }
-    mb.setValue(++k);
+void WordIndex::mergePage(int k) {
+  // The single merge step; always on the GUI thread
+  if (merged[k] || !watcher->future().isResultReadyAt(k))
+    return;
+  merged[k] = true;
+  nMerged++;
+  PageWords res = watcher->resultAt(k);
+  if (touched.contains(res.pgno))
+    return; // reindexed from a newer version in the meantime
+  if (!res.ok) {
+    qDebug() << "WordIndex: Cannot load entry" << res.pgno;
+    warns << QString("%1").arg(res.pgno);
+  } else if (res.unchanged) {
+    lastseen[res.pgno] = QDateTime::currentDateTime();
+  } else {
+    setPageWords(res.pgno, res.words);
   }
-  mb.close();
+}
+
+void WordIndex::pageIndexed(int k) {
+  mergePage(k);
+  emit progress(nMerged, merged.size());
+}
+
+void WordIndex::buildFinished() {
+  if (!watcher)
+    return;
+  for (int k=0; k<merged.size(); k++)
+    mergePage(k);
+  qDebug() << "WordIndex: indexed" << nMerged << "pages in"
+           << buildTime.elapsed() << "ms";
+  watcher->disconnect(this);
+  watcher->deleteLater();
+  watcher = 0;
+  touched.clear();
   if (!warns.isEmpty())
     QMessageBox::warning(0, Translate::_("eln"),
                          "The following pages could not be loaded"
                          " while updating the search index: "
                          + warns.join(", ") + ".", QMessageBox::Close);
-  return true;
+  warns.clear();
+  emit ready();
 }
-  
 
-    
+void WordIndex::waitForBuild() {
+  if (!watcher)
+    return;
+  watcher->waitForFinished();
+  buildFinished();
+}
+
+#if 0
+// Benchmark: prefix lookup on a vocabulary of 500k distinct words
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+static QSet<int> scanPrefix(QMap< QString, QSet<int> > const &idx,
+                            QString wordbit) {
+  // The old approach: look at every word
+  QSet<int> s;
+  for (auto i = idx.begin(); i!=idx.end(); ++i)
+    if (i.key().startsWith(wordbit))
+      s |= i.value();
+  return s;
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QMap< QString, QSet<int> > plain;
+  QMap< int, QSet<QString> > pages;
+  for (int w=0; w<500000; w++) {
+    QString word = QString::number(w*2654435761u % 1000003, 36);
+    for (int k=0; k<1 + w%5; k++) {
+      int pg = (w*7 + k*13) % 3000 + 1;
+      plain[word].insert(pg);
+      pages[pg].insert(word);
+    }
+  }
+  WordIndex widx;
+  for (auto i=pages.begin(); i!=pages.end(); ++i)
+    widx.rebuildEntry(i.key(), i.value());
+  widx.save("/tmp/bench.eli");
+  widx.load("/tmp/bench.eli");
+  qDebug() << "Vocabulary:" << plain.size();
+
+  QStringList prefixes;
+  prefixes << "a" << "ab" << "abc" << "z" << "1k" << "q7x";
+  for (QString p: prefixes) {
+    QElapsedTimer t;
+    t.start();
+    QSet<int> s0;
+    for (int r=0; r<10; r++)
+      s0 = scanPrefix(plain, p);
+    qint64 ms0 = t.elapsed();
+    t.restart();
+    QSet<int> s1;
+    for (int r=0; r<10; r++)
+      s1 = widx.findPartialWord(p);
+    qint64 ms1 = t.elapsed();
+    qDebug() << p << "scan:" << ms0/10. << "ms"
+             << "range:" << ms1/10. << "ms"
+             << "hits:" << s1.size() << (s0==s1 ? "same" : "DIFFERENT");
+  }
+  return 0;
+}
+#endif
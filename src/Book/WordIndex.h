@@ -23,6 +23,11 @@
 #include <QSet>
 #include <QDateTime>
 #include <QVariant>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+
+struct PageWords;
 
 class WordIndex: public QObject {
   Q_OBJECT;
@@ -30,24 +35,75 @@ public:
   WordIndex(QObject *parent=0);
   virtual ~WordIndex();
   bool load(QString filename);
+  /* Reads either the compact binary format (see PostingFile) or the
+     older JSON format, which is still accepted for migration. */
   bool save(QString filename);
-  bool build(class TOC *toc, QString pagesDir);
-  /* Returns true unless canceled by user. */
-  void rebuildEntry(int startPage, QSet<QString> newset,
-                    QSet<QString> *oldset=0);
+  /* Always saves in the compact format. */
+  bool exportJSON(QString filename) const;
+  /* Saves in the older JSON format, which is handy for debugging. */
+  void build(class TOC const *toc, QString pagesDir);
+  /* Starts indexing all pages from scratch, and returns immediately.
+     Pages are loaded and split into words on a worker pool; the results
+     are merged in on the GUI thread as they come in. The index can be
+     searched all along, but results are incomplete until ready(). */
+  bool update(class TOC const *, QString pgdir);
+  /* Like build, but only for pages changed since they were last seen.
+     Returns false, without emitting ready(), if nothing has changed. */
+  bool isBuilding() const { return watcher!=0; }
+  void waitForBuild();
+  /* Blocks until a build or update is complete. */
+  bool rebuildEntry(int startPage, QSet<QString> newset);
+  /* Only the posting lists of words that were added to or removed from
+     the page are touched. Returns true if there were any. */
+  bool updateEntry(int startPage, QSet<QString> const &added,
+                   QSet<QString> const &removed);
+  /* Like rebuildEntry, for when the caller already knows which words
+     were added to or removed from the page. Returns true if any were. */
   void dropEntry(int startPage);
+  QSet<QString> pageWords(int startPage) const;
   QSet<int> findWord(QString word);
   QSet<int> findPartialWord(QString wordbit); // must match at beginning of word
+  QVector<int> pagesWithPrefix(QString wordbit) const;
+  /* Like findPartialWord, but returns a sorted list. */
   QSet<int> findWords(QStringList words, bool lastPartial=false);
   /* Returned integers are start pages of entries */
   QDateTime lastSeen(int pg) const;
-  bool update(class TOC const *, QString pgdir); // true if changed
+signals:
+  void progress(int done, int total);
+  void ready(); // build or update complete
+private slots:
+  void pageIndexed(int k);
+  void buildFinished();
 private:
+  void startJobs(class TOC const *toc, QString pagesDir, bool all);
+  void mergePage(int k);
+  bool setPageWords(int startPage, QSet<QString> newset);
+  bool loadJSON(QString filename);
   void buildIndex(QVariantMap const &idx);
+  void clear();
+  QVector<int> postings(QString word) const;
+  QVector<int> &editable(QString word);
+  void addPosting(QString word, int pg);
+  void removePosting(QString word, int pg);
+  QStringList words() const; // in order, including those only in base
 private:
-  QMap< QString, QSet<int> > index;
-  /* Maps words to sets of start pages */
+  class PostingFile *base;
+  /* The index as last saved. Posting lists are only decoded on lookup. */
+  QString basefn;
+  QMap< QString, QVector<int> > overlay;
+  /* Maps words to sorted lists of start pages. Entries here take
+     precedence over those in base; an empty list marks a word that
+     no longer occurs anywhere. */
+  QMap< int, QSet<QString> > fwdOverlay;
+  /* Maps start pages to the words on them, for pages changed since the
+     base was saved. An empty set marks a dropped page. */
   QMap<int, QDateTime> lastseen;
+  QFutureWatcher<PageWords> *watcher; // only while building
+  QVector<bool> merged; // which results have been merged
+  QSet<int> touched; // pages reindexed by others while building
+  QStringList warns; // pages that could not be loaded
+  int nMerged;
+  QElapsedTimer buildTime;
 };
 
 #endif
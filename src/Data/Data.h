@@ -27,6 +27,7 @@
 #include <QVariant>
 #include <QMap>
 #include <QSet>
+#include <QVector>
 
 class Data: public QObject {
   Q_OBJECT;
@@ -42,6 +43,20 @@ public:
     /* This has no effect on whether the Data will be saved to disk: that
        always happens, except while loading. */
   };
+public:
+  class ModBatch {
+    /* While a ModBatch exists, markModified() does its usual work, but
+       rather than emitting mod() right away, it makes a note. When the
+       outermost ModBatch goes out of scope, every Data that was modified
+       emits mod() exactly once. All modification times set during the
+       batch are the same. Use this around bulk operations. */
+  public:
+    ModBatch();
+    ~ModBatch();
+  private:
+    ModBatch(ModBatch const &);
+    ModBatch &operator=(ModBatch const &);
+  };
 public:
   // constructor and destructor
   Data(Data *parent=0);
@@ -60,6 +75,10 @@ public:
   // other
   virtual void markModified(ModType mt=UserVisibleMod);
   void load(QVariantMap const &);
+  void load(class DataLoader &src, QMap<QString, char const *> const &mm);
+  /* Loads straight from the parser, given our members as returned by
+     DataLoader::readMembers(). Children are created as they are read.
+     Throws JSONParser::Error on bad input. */
   QVariantMap save() const;
   virtual bool isWritable() const;
   virtual bool lateNotesAllowed() const;
@@ -68,6 +87,8 @@ public:
   QList<Data *> const &allChildren() const { return children_; }
   template <class T> QList<T *> children() const;
   template <class T> T *firstChild() const;
+  /* These are cached per type, so repeated calls are cheap as long as
+     the list of children does not change. */
   Data const*findChildByUUID(QString uuid) const;
   
   void insertChildBefore(Data *newChild, Data *ref, ModType mt=UserVisibleMod);
@@ -89,11 +110,17 @@ signals:
   void mod();
 protected:
   virtual void loadMore(QVariantMap const &);
+  /* When loading through a DataLoader, the map only contains those
+     members that are neither properties nor "cc" or "res". */
   virtual void saveMore(QVariantMap &) const;
   bool loading() const;
 private:
+  struct Schema;
+  Schema const &schema() const;
+  bool loadProp(Schema const &, QString const &key, QVariant const &value);
   void loadProps(QVariantMap const &);
   void saveProps(QVariantMap &) const;
+  void dropChildren();
   void loadChildren(QVariantMap const &);
   void saveChildren(QVariantMap &) const;
   void loadResTags(QVariantMap const &);
@@ -105,17 +132,36 @@ private:
   QString uuid_;
   QList<Data *> children_;
   QStringList resTags;
+private:
+  struct TypedChildrenBase {
+    virtual ~TypedChildrenBase() { }
+  };
+  template <class T> struct TypedChildren: TypedChildrenBase {
+    TypedChildren(): suspect(0), suspectMeta(0) { }
+    QList<T *> list;
+    Data const *suspect; // see children()
+    QMetaObject const *suspectMeta;
+  };
+  mutable QVector<TypedChildrenBase *> typedChildren_; // indexed by typeId
+  void childrenChanged();
 private:
   bool loading_;
 public:
   template <class T> static T *deepCopy(T const *data);
   /* T must be derived from Data. The copy will be parentless. */
   /* Caution! deepCopy() does not attach signals and slots to the new vsn. */
+public:
+  template <class T> static int typeId();
+  /* A small integer that identifies the class T. Ids are assigned by
+     Creator, or on first use for classes that have no Creator. */
+private:
+  static int nextTypeId();
 public: // but only to be used in defs of descendents
   template <class T> class Creator {
   public:
     Creator<T>(QString typ) {
       Data::creators()[typ] = &create;
+      Data::typeId<T>();
     }
     static Data *create(Data *parent=0) {
       return new T(parent);
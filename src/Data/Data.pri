@@ -27,6 +27,7 @@ HEADERS += \
      Data/TextData.h  \
      Data/TitleData.h  \
      Data/UUID.h  \
+     Data/WordTokenizer.h  \
 
 SOURCES += \
      Data/BlockData.cpp  \
@@ -54,6 +55,7 @@ SOURCES += \
      Data/TextData.cpp  \
      Data/TitleData.cpp  \
      Data/UUID.cpp  \
+     Data/WordTokenizer.cpp  \
 
 RESOURCES += \
 
@@ -20,25 +20,51 @@
 
 #define DATATEMPLATES_H
 
+template <class T> int Data::typeId() {
+  static int id = nextTypeId();
+  return id;
+}
+
 template <class T> QList<T *> Data::children() const {
-  QList<T *> res;
+  int id = typeId<T>();
+  if (id<typedChildren_.size() && typedChildren_[id]) {
+    TypedChildren<T> *tc = static_cast<TypedChildren<T> *>(typedChildren_[id]);
+    if (!tc->suspect || tc->suspect->metaObject()==tc->suspectMeta)
+      return tc->list;
+    // The suspect has finished construction; it may be a T after all
+    delete tc;
+    typedChildren_[id] = 0;
+  }
+
+  TypedChildren<T> *tc = new TypedChildren<T>;
   for (QList<Data*>::const_iterator i=children_.begin();
        i!=children_.end(); ++i) {
     T *c = dynamic_cast<T*>(*i);
     if (c)
-      res.append(c);
+      tc->list.append(c);
+  }
+  /* Data::Data already makes a new object our child, so the last child
+     may be a T whose constructor has not finished, and whose cast
+     fails for now. If it might be, we note its current class: once
+     that changes, the list must be rebuilt. A child that really is of
+     a base class of T never changes, so its list stays cached. */
+  if (!children_.isEmpty()) {
+    Data const *last = children_.last();
+    if (!dynamic_cast<T const *>(last)
+        && T::staticMetaObject.inherits(last->metaObject())) {
+      tc->suspect = last;
+      tc->suspectMeta = last->metaObject();
+    }
   }
-  return res;
+  if (id>=typedChildren_.size())
+    typedChildren_.resize(id+1);
+  typedChildren_[id] = tc;
+  return tc->list;
 }
 
 template <class T> T *Data::firstChild() const {
-  for (QList<Data*>::const_iterator i=children_.begin();
-       i!=children_.end(); ++i) {
-    T *c = dynamic_cast<T*>(*i);
-    if (c)
-      return c;
-  }
-  return 0;
+  QList<T *> cc = children<T>();
+  return cc.isEmpty() ? 0 : cc.first();
 }
 
 template <class T> T *Data::deepCopy(T const *data) {
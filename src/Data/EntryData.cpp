@@ -104,6 +104,53 @@ void EntryData::newSheet() {
   }
 }  
 
+QList<Data *> EntryData::findByUuid(QString uuid) const {
+  return uuidIndex.values(uuid);
+}
+
+void EntryData::indexUuids(Data *subtree) {
+  if (!uuidIndex.contains(subtree->uuid(), subtree))
+    uuidIndex.insert(subtree->uuid(), subtree);
+  for (Data *d: subtree->allChildren())
+    indexUuids(d);
+}
+
+void EntryData::unindexUuids(Data *subtree) {
+  uuidIndex.remove(subtree->uuid(), subtree);
+  for (Data *d: subtree->allChildren())
+    unindexUuids(d);
+}
+
+void EntryData::reindexUuid(Data *d, QString olduuid) {
+  uuidIndex.remove(olduuid, d);
+  if (!uuidIndex.contains(d->uuid(), d))
+    uuidIndex.insert(d->uuid(), d);
+}
+
+static void collectUuids(Data const *d, QMultiHash<QString, Data *> &dst) {
+  for (Data *c: d->allChildren()) {
+    dst.insert(c->uuid(), c);
+    collectUuids(c, dst);
+  }
+}
+
+bool EntryData::checkUuidIndex() const {
+  QMultiHash<QString, Data *> full;
+  collectUuids(this, full);
+  if (full.size()!=uuidIndex.size()) {
+    qDebug() << "EntryData: uuid index has" << uuidIndex.size()
+             << "items; tree has" << full.size();
+    return false;
+  }
+  for (auto it=full.constBegin(); it!=full.constEnd(); ++it) {
+    if (!uuidIndex.contains(it.key(), it.value())) {
+      qDebug() << "EntryData: uuid index lacks" << it.key();
+      return false;
+    }
+  }
+  return true;
+}
+
 void EntryData::loadMore(QVariantMap const &src) {
   Data::loadMore(src);
   TitleData *title_ = firstChild<TitleData>();
@@ -118,6 +165,10 @@ void EntryData::loadMore(QVariantMap const &src) {
     connect(b, SIGNAL(newSheet(int)), SLOT(newSheet()));
     connect(b, SIGNAL(sheetCountMod(int)), SLOT(newSheet()));
   }
+#ifndef QT_NO_DEBUG
+  // Loading is where the index sees the bulk of its insertions
+  MILDASSERT(checkUuidIndex());
+#endif
 }
 
 TitleData *EntryData::title() {
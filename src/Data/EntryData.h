@@ -23,6 +23,7 @@
 #include "Data.h"
 #include <QList>
 #include <QPointer>
+#include <QMultiHash>
 
 class EntryData: public Data {
   Q_OBJECT;
@@ -64,6 +65,16 @@ public:
   EntryData *entry();
   bool isEmpty() const; // true iff no blocks and title is default
   virtual void markModified(ModType mt=UserVisibleMod);
+  // uuid index, maintained by Data
+  QList<Data *> findByUuid(QString uuid) const;
+  /* Returns all our descendents with the given uuid. Normally, there is
+     at most one, but a deepCopy has the same uuid as its original. */
+  void indexUuids(Data *subtree);
+  void unindexUuids(Data *subtree);
+  void reindexUuid(Data *d, QString olduuid);
+  bool checkUuidIndex() const;
+  /* Verifies the index against a full walk of our tree. For debugging;
+     debug builds run it once after loading, not on every lookup. */
 signals:
   void titleMod();
   void sheetCountMod();
@@ -80,6 +91,7 @@ protected:
   int maxSheet;
   Notebook *nb;
   bool wasEmpty;
+  QMultiHash<QString, Data *> uuidIndex;
 };
 
 #endif
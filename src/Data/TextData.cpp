@@ -17,6 +17,7 @@
 // TextData.C
 
 #include "TextData.h"
+#include "WordTokenizer.h"
 #include <QDebug>
 
 static Data::Creator<TextData> c("text");
@@ -24,6 +25,8 @@ static Data::Creator<TextData> c("text");
 TextData::TextData(Data *parent):
   Data(parent) {
   setType("text");
+  hascounts_ = false;
+  unnoted_ = 0;
 }
 
 TextData::~TextData() {
@@ -46,6 +49,7 @@ void TextData::setText(QString const &t, bool hushhush) {
     return;
   text_ = t;
   wordset_.clear();
+  unnoted_ ++;
   if (!hushhush)
     markModified();
 }
@@ -160,9 +164,133 @@ QList<int> TextData::paragraphStarts() const {
 
 QSet<QString> TextData::wordSet() const {
   if (wordset_.isEmpty() && !text_.isEmpty()) {
-    for (QString w: text_.split(QRegExp("\\W+")))
-      if (!w.isEmpty())
-        wordset_ << w.toLower();
+    if (hascounts_ && unnoted_==0) {
+      wordset_.reserve(wordcount_.size());
+      for (auto i=wordcount_.constBegin(); i!=wordcount_.constEnd(); ++i)
+        wordset_.insert(i.key());
+    } else {
+      wordset_ = WordTokenizer::wordSet(text_);
+    }
   }
+  if (allChildren().isEmpty())
+    return wordset_; // no need to copy
   return wordset_ | Data::wordSet();
 }
+
+void TextData::changeCount(QString const &word, int delta) const {
+  auto i = wordcount_.find(word);
+  if (i==wordcount_.end())
+    wordcount_.insert(word, delta);
+  else if ((*i += delta) == 0)
+    wordcount_.erase(i);
+  auto j = wordchanges_.find(word);
+  if (j==wordchanges_.end())
+    wordchanges_.insert(word, delta);
+  else if ((*j += delta) == 0)
+    wordchanges_.erase(j);
+}
+
+void TextData::syncWordCounts() const {
+  if (hascounts_ && unnoted_==0)
+    return;
+  if (hascounts_ && counted_==text_) {
+    unnoted_ = 0;
+    return;
+  }
+  // Full recount. Report the difference, as if it had been an edit.
+  QHash<QString, int> counts;
+  WordTokenizer::countWords(text_, counts);
+  if (hascounts_) {
+    for (auto i=wordcount_.constBegin(); i!=wordcount_.constEnd(); ++i)
+      counts[i.key()] -= i.value();
+    for (auto i=counts.constBegin(); i!=counts.constEnd(); ++i)
+      if (i.value())
+        changeCount(i.key(), i.value());
+  } else {
+    wordcount_ = counts;
+    wordchanges_ = counts;
+    hascounts_ = true;
+  }
+  counted_ = text_;
+  unnoted_ = 0;
+}
+
+QHash<QString, int> const &TextData::wordCounts() const {
+  syncWordCounts();
+  return wordcount_;
+}
+
+QHash<QString, int> TextData::takeWordChanges() {
+  syncWordCounts();
+  QHash<QString, int> res;
+  res.swap(wordchanges_);
+  return res;
+}
+
+void TextData::noteEdit(int pos, int nDel, int nIns) {
+  if (!hascounts_)
+    return; // nobody has asked yet, so we will count from scratch
+  int n0 = counted_.size();
+  if (unnoted_!=1 || pos<0 || nDel<0 || nIns<0 || pos+nDel>n0
+      || n0 - nDel + nIns != text_.size())
+    return; // not the edit we expected; syncWordCounts will recount
+  /* The text before POS and after the edit is unchanged, so widening
+     the edited range to word boundaries gives the same result on
+     either side in the old and the new text. */
+  int s0 = pos;
+  int e0 = pos + nDel;
+  WordTokenizer::widen(counted_, s0, e0);
+  int s1 = pos;
+  int e1 = pos + nIns;
+  WordTokenizer::widen(text_, s1, e1);
+  QHash<QString, int> delta;
+  WordTokenizer::countWords(counted_.mid(s0, e0 - s0), delta, -1);
+  WordTokenizer::countWords(text_.mid(s1, e1 - s1), delta, 1);
+  for (auto i=delta.constBegin(); i!=delta.constEnd(); ++i)
+    if (i.value())
+      changeCount(i.key(), i.value());
+  counted_ = text_;
+  unnoted_ = 0;
+}
+
+#if 0
+// Benchmark: one keystroke in a long text, full recount vs. noteEdit
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QString text;
+  for (int k=0; text.size()<100000; k++)
+    text += QString("word%1 spike%2, neuron. ").arg(k % 997).arg(k % 13);
+  TextData full;
+  TextData incr;
+  full.setText(text, true);
+  incr.setText(text, true);
+  full.takeWordChanges();
+  incr.takeWordChanges();
+
+  int const N = 1000;
+  QElapsedTimer t;
+  t.start();
+  for (int k=0; k<N; k++) {
+    int pos = (k*7919) % text.size();
+    QString t1 = full.text();
+    full.setText(t1.left(pos) + "x" + t1.mid(pos), true);
+    full.takeWordChanges(); // setText without noteEdit forces a recount
+  }
+  qDebug() << "Full recount:" << t.elapsed()*1000./N << "us per edit";
+
+  t.restart();
+  for (int k=0; k<N; k++) {
+    int pos = (k*7919) % text.size();
+    QString t1 = incr.text();
+    incr.setText(t1.left(pos) + "x" + t1.mid(pos), true);
+    incr.noteEdit(pos, 0, 1);
+    incr.takeWordChanges();
+  }
+  qDebug() << "noteEdit:" << t.elapsed()*1000./N << "us per edit";
+  qDebug() << "Identical:" << (full.wordCounts()==incr.wordCounts());
+  return 0;
+}
+#endif
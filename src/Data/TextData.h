@@ -23,6 +23,7 @@
 #include "Data.h"
 #include "MarkupData.h"
 #include <QVector>
+#include <QHash>
 
 class TextData: public Data {
   Q_OBJECT;
@@ -64,6 +65,17 @@ public:
   /* This overload finds markups regardless of type. */
   int offsetOfFootnoteTag(QString) const;
   virtual QSet<QString> wordSet() const override;
+  QHash<QString, int> const &wordCounts() const;
+  /* Number of occurrences of each word in the text. Once computed, the
+     counts are kept up to date by noteEdit(). */
+  QHash<QString, int> takeWordChanges();
+  /* Net change in wordCounts() since the previous call. The first call
+     reports every word. Words that did not change are not included. */
+public slots:
+  void noteEdit(int pos, int nDel, int nIns);
+  /* Connected to TextItemDoc::contentsChanged(). Only the words around
+     the edit are tokenized again. Any other change to the text is
+     caught up with by a full recount when the counts are next needed. */
 protected:
   virtual void loadMore(QVariantMap const &);
   virtual void saveMore(QVariantMap &) const;
@@ -71,6 +83,15 @@ protected:
   QString text_;
   QVector<int> linestarts;
   mutable QSet<QString> wordset_;
+private:
+  void syncWordCounts() const;
+  void changeCount(QString const &word, int delta) const;
+private:
+  mutable QHash<QString, int> wordcount_;
+  mutable QHash<QString, int> wordchanges_;
+  mutable QString counted_; // the text that wordcount_ describes
+  mutable bool hascounts_;
+  mutable int unnoted_; // calls to setText since counted_ was current
 };
 
 #endif
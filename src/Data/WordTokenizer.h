@@ -0,0 +1,47 @@
+// Data/WordTokenizer.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// WordTokenizer.H
+
+#ifndef WORDTOKENIZER_H
+
+#define WORDTOKENIZER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QSet>
+#include <QHash>
+
+class WordTokenizer {
+  /* Splits text into lower-case words. The result is exactly what
+     splitting on QRegExp("\\W+") and lower-casing each piece would give,
+     but the text is scanned only once, ASCII takes a table-driven fast
+     path, and case folding happens in place in a single copy of the
+     text. Duplicate words are weeded out before any QString is made. */
+public:
+  static QSet<QString> wordSet(QString const &text);
+  static void words(QString const &text, QStringList &words,
+                    QVector<int> &offsets);
+  /* Every word in order, with its offset in TEXT. */
+  static void countWords(QString const &text, QHash<QString, int> &counts,
+                         int delta=1);
+  /* Adds DELTA to COUNTS for each occurrence of each word in TEXT. */
+  static void widen(QString const &text, int &start, int &end);
+  /* Extends [START, END) so that it does not cut through any word. */
+};
+
+#endif
@@ -28,7 +28,6 @@
 #include "SheetScene.h"
 
 #include <QInputDialog>
-#include <QProgressDialog>
 #include <QMessageBox>
 #include <QDebug>
 
@@ -50,26 +49,33 @@ void SearchDialog::newSearch() {
   if (phrase.isEmpty())
     return;
 
-  QProgressDialog *progress = new QProgressDialog(pgView);
-  progress->setLabelText("Searching...");
-  progress->setCancelButton(0);
-  progress->setMinimumDuration(500);
-  progress->setValue(0);
+  /* The search runs in the background. The results window opens as soon
+     as the first results are in, and grows as more come in. */
   Search *search = new Search(pgView->notebook());
-  QList<SearchResult> res = search->immediatelyFindPhrase(phrase);
+  search->setParent(this);
+  connect(search, SIGNAL(resultsFound(QList<SearchResult>)),
+          SLOT(showResults(QList<SearchResult>)));
+  connect(search, SIGNAL(searchCompleted()), SLOT(searchDone()));
+  connect(search, SIGNAL(destroyed(QObject*)), SLOT(forgetSearch(QObject*)));
+  search->startSearchForPhrase(phrase);
+}
 
-  if (res.isEmpty()) {
-    delete progress;
-    QMessageBox::information(pgView, "Search - eln",
-                             QString::fromUtf8("Search phrase “%1” not found")
-                             .arg(phrase));
+void SearchDialog::showResults(QList<SearchResult> res) {
+  Search *search = qobject_cast<Search *>(sender());
+  if (!search || !pgView)
+    return;
+  if (scenes.contains(search)) {
+    if (scenes[search])
+      scenes[search]->appendResults(res);
     return;
   }
-  
+
+  QString phrase = search->currentPhrase();
+  QString sttl = QString::fromUtf8("Search results for “%1”").arg(phrase);
+  if (search->isIndexIncomplete())
+    sttl += " (index still building)";
   SearchResultScene *scene
-    = new SearchResultScene(phrase,
-			    QString::fromUtf8("Search results for “%1”")
-			    .arg(phrase),
+    = new SearchResultScene(phrase, sttl,
 			    res,
 			    pgView->notebook()->bookData());
   scene->populate();
@@ -81,7 +87,9 @@ void SearchDialog::newSearch() {
   SearchView *view = new SearchView(scene);
   view->setAttribute(Qt::WA_DeleteOnClose, true);
   connect(parent(), SIGNAL(destroyed()), view, SLOT(close()));
-  delete progress;
+  scenes[search] = scene;
+  // Closing the window abandons the search
+  search->setParent(scene);
   
   view->resize(pgView->size()*.9);
   QString ttl = pgView->notebook()->bookData()->title();
@@ -90,6 +98,24 @@ void SearchDialog::newSearch() {
   view->show();
 }
 
+void SearchDialog::searchDone() {
+  Search *search = qobject_cast<Search *>(sender());
+  if (!search)
+    return;
+  if (search->searchResults().isEmpty() && pgView) {
+    QString msg = QString::fromUtf8("Search phrase “%1” not found")
+      .arg(search->currentPhrase());
+    if (search->isIndexIncomplete())
+      msg += ". The search index is still being built.";
+    QMessageBox::information(pgView, "Search - eln", msg);
+  }
+  search->deleteLater();
+}
+
+void SearchDialog::forgetSearch(QObject *search) {
+  scenes.remove(search);
+}
+
 void SearchDialog::gotoPage(int n, Qt::KeyboardModifiers m,
                             QString uuid, QString phrase) {
   setLatestPhrase(phrase);
@@ -22,7 +22,9 @@
 
 #include <QObject>
 #include <QPointer>
+#include <QMap>
 #include "PageView.h"
+#include "Search.h"
 
 class SearchDialog: public QObject {
   Q_OBJECT;
@@ -35,9 +37,14 @@ public slots:
   void newSearch();
 private slots:
   void gotoPage(int n, Qt::KeyboardModifiers, QString uuid, QString phrase);
+  void showResults(QList<SearchResult>);
+  void searchDone();
+  void forgetSearch(QObject *);
 private:
   QPointer<PageView> pgView;
   QString lastPhrase;
+  QMap<QObject *, QPointer<class SearchResultScene> > scenes;
+  /* Scenes showing the results of searches still in progress. */
   static QString &storedPhrase();
 };
 
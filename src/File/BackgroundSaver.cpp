@@ -0,0 +1,193 @@
+// File/BackgroundSaver.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// BackgroundSaver.cpp
+
+#include "BackgroundSaver.h"
+#include "DataFile.h"
+#include "JSONFile.h"
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDebug>
+
+BackgroundSaver *BackgroundSaver::instance() {
+  /* Never deleted, and not owned by the application, so that it is still
+     there for DataFiles that are destructed after the application object.
+     See shutdown(). */
+  static BackgroundSaver *bs = new BackgroundSaver();
+  return bs;
+}
+
+BackgroundSaver::BackgroundSaver() {
+  lastSerial = 0;
+  stopping = false;
+  filesWritten = 0;
+  bytesWritten = 0;
+  msWriting = 0;
+  connect(this, SIGNAL(jobDone(quint64, bool)),
+          SLOT(deliver(quint64, bool)), Qt::QueuedConnection);
+  start();
+}
+
+BackgroundSaver::~BackgroundSaver() {
+  shutdown();
+}
+
+void BackgroundSaver::shutdown() {
+  mutex.lock();
+  stopping = true;
+  wakeWorker.wakeAll();
+  mutex.unlock();
+  wait(); // the queue is drained before the thread stops
+}
+
+quint64 BackgroundSaver::enqueue(DataFile0 *df, QString fn,
+                                 QVariantMap const &data) {
+  QMutexLocker l(&mutex);
+  quint64 serial = ++lastSerial;
+  owners[serial] = df;
+  if (stopping) {
+    // The thread is gone, so we write right here
+    Job job;
+    job.serials << serial;
+    job.fn = fn;
+    job.data = data;
+    l.unlock();
+    write(job);
+    return serial;
+  }
+  for (Job &job: queue) {
+    if (job.fn==fn) {
+      job.data = data;
+      job.serials << serial;
+      return serial;
+    }
+  }
+  Job job;
+  job.serials << serial;
+  job.fn = fn;
+  job.data = data;
+  queue << job;
+  wakeWorker.wakeAll();
+  return serial;
+}
+
+bool BackgroundSaver::isPending(quint64 serial) const {
+  if (busy.contains(serial))
+    return true;
+  for (Job const &job: queue)
+    if (job.serials.contains(serial))
+      return true;
+  return false;
+}
+
+bool BackgroundSaver::waitFor(quint64 serial) {
+  QMutexLocker l(&mutex);
+  while (isPending(serial))
+    jobFinished.wait(&mutex);
+  owners.remove(serial);
+  return results.take(serial);
+}
+
+void BackgroundSaver::cancel(quint64 serial) {
+  QMutexLocker l(&mutex);
+  for (int k=0; k<queue.size(); k++) {
+    if (queue[k].serials.contains(serial)) {
+      for (quint64 s: queue[k].serials)
+        owners.remove(s);
+      queue.removeAt(k);
+      return;
+    }
+  }
+  while (busy.contains(serial))
+    jobFinished.wait(&mutex);
+  owners.remove(serial);
+  results.remove(serial);
+}
+
+void BackgroundSaver::waitForIdle() {
+  QMutexLocker l(&mutex);
+  while (!queue.isEmpty() || !busy.isEmpty())
+    jobFinished.wait(&mutex);
+}
+
+void BackgroundSaver::counters(int &files, qint64 &bytes, qint64 &ms) const {
+  QMutexLocker l(&mutex);
+  files = filesWritten;
+  bytes = bytesWritten;
+  ms = msWriting;
+}
+
+void BackgroundSaver::deliver(quint64 serial, bool ok) {
+  // We are in the GUI thread here
+  mutex.lock();
+  bool fresh = results.remove(serial);
+  mutex.unlock();
+  QPointer<DataFile0> df = owners.take(serial);
+  if (fresh && df)
+    df->backgroundSaveDone(serial, ok);
+}
+
+void BackgroundSaver::run() {
+  mutex.lock();
+  while (true) {
+    while (queue.isEmpty() && !stopping)
+      wakeWorker.wait(&mutex);
+    if (queue.isEmpty())
+      break; // only if stopping
+
+    Job job = queue.takeFirst();
+    for (quint64 s: job.serials)
+      busy.insert(s);
+    mutex.unlock();
+    write(job);
+    mutex.lock();
+  }
+  mutex.unlock();
+}
+
+void BackgroundSaver::write(Job const &job) {
+  // Called without the mutex held
+  QElapsedTimer t;
+  t.start();
+  QString dir = QFileInfo(job.fn).absolutePath();
+  QDateTime dirBefore = QFileInfo(dir).lastModified();
+  bool ok = JSONFile::save(job.data, job.fn);
+  qint64 size = 0;
+  if (ok) {
+    QFileInfo fi(job.fn);
+    size = fi.size();
+    emit written(job.fn, fi.lastModified(), size,
+                 dirBefore, QFileInfo(dir).lastModified());
+  } else
+    qDebug() << "BackgroundSaver: Failed to save" << job.fn;
+
+  mutex.lock();
+  msWriting += t.elapsed();
+  if (ok) {
+    filesWritten ++;
+    bytesWritten += size;
+  }
+  for (quint64 s: job.serials) {
+    busy.remove(s);
+    results[s] = ok;
+  }
+  jobFinished.wakeAll();
+  mutex.unlock();
+  for (quint64 s: job.serials)
+    emit jobDone(s, ok);
+}
@@ -0,0 +1,92 @@
+// File/BackgroundSaver.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// BackgroundSaver.H
+
+#ifndef BACKGROUNDSAVER_H
+
+#define BACKGROUNDSAVER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVariant>
+#include <QPointer>
+#include <QMap>
+#include <QSet>
+#include <QDateTime>
+
+class BackgroundSaver: public QThread {
+  /* A single I/O thread that serializes and writes snapshots of DataFiles.
+     The GUI thread takes the snapshot (a QVariantMap, which is cheap to
+     hand over because of implicit sharing); everything else happens here.
+     Results are reported back to the DataFile0 on the GUI thread.
+     All public methods must be called from the GUI thread. */
+  Q_OBJECT;
+public:
+  static BackgroundSaver *instance();
+  quint64 enqueue(class DataFile0 *df, QString fn, QVariantMap const &data);
+  /* Returns a serial number that identifies the job. If a job for the
+     same file is still waiting, its data are simply replaced. */
+  bool waitFor(quint64 serial);
+  /* Blocks until the given job has been written. Returns true if OK.
+     The DataFile0 will not be notified separately. */
+  void cancel(quint64 serial);
+  /* Drops the given job if not yet started; otherwise waits for it. */
+  void waitForIdle();
+  /* Blocks until nothing is being written or waiting to be written. */
+  void counters(int &files, qint64 &bytes, qint64 &ms) const;
+  /* Reports number of files written so far, their total size, and the
+     time spent writing them. */
+  void shutdown();
+  /* Writes whatever is still queued, and stops the thread. Call this
+     once, at the end of main(). Later saves are written synchronously. */
+signals:
+  void written(QString fn, QDateTime mod, qint64 size,
+               QDateTime dirBefore, QDateTime dirAfter);
+  /* Emitted after each successful write, with the file's new modification
+     time and size, and that of its folder just before and just after. */
+  void jobDone(quint64 serial, bool ok); // for internal use
+private slots:
+  void deliver(quint64 serial, bool ok);
+protected:
+  void run();
+private:
+  BackgroundSaver();
+  virtual ~BackgroundSaver();
+  bool isPending(quint64 serial) const;
+private:
+  struct Job {
+    QList<quint64> serials;
+    QString fn;
+    QVariantMap data;
+  };
+  void write(Job const &job);
+  QList<Job> queue;
+  QSet<quint64> busy; // being written right now
+  QMap<quint64, bool> results; // written, but not yet reported
+  QMap<quint64, QPointer<class DataFile0> > owners; // only used in GUI thread
+  quint64 lastSerial;
+  bool stopping;
+  int filesWritten;
+  qint64 bytesWritten;
+  qint64 msWriting;
+  mutable QMutex mutex;
+  QWaitCondition wakeWorker;
+  QWaitCondition jobFinished;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include "DataFile.h"
 #include "DFBlocker.h"
+#include "SaveScheduler.h"
 #include "Assert.h"
 #include "VersionControl.h"
 
@@ -74,6 +75,8 @@ bool BackgroundVC::commit(QString path1, QString program1) {
   guard->setInterval(maxt_s*1000);
   guard->start();
 
+  // Make sure that everything is on disk before we start
+  SaveScheduler::instance()->flushBarrier();
   block = new DFBlocker(this);
 
   vc = new QProcess(this);
@@ -18,11 +18,14 @@
 
 #include "DataFile.h"
 #include <QDebug>
-#include <QTimer>
-#include "JSONFile.h"
 #include "Assert.h"
 #include "DFBlocker.h"
 #include "PointerSet.h"
+#include "BackgroundSaver.h"
+#include "SaveScheduler.h"
+#include "StartupProfile.h"
+#include "DataLoader.h"
+#include <QFile>
 
 double DataFile0::saveDelay_s = 5; // save every 5 s
 
@@ -30,30 +33,82 @@ void DataFile0::setSaveDelay(double t_s) {
   saveDelay_s = t_s;
 }
 
-DataFile0::DataFile0(QString fn, QObject *parent):
+double DataFile0::saveDelay() {
+  return saveDelay_s;
+}
+
+DataFile0::DataFile0(QString fn, QObject *parent, bool detached):
   QObject(parent),
   data_(0),
   fn_(fn),
   needToSave_(false),
-  saveTimer_(0) {
-  
-  QVariantMap v = JSONFile::load(fn, &ok_);
+  detached_(detached),
+  pendingSave_(0) {
+
+  ok_ = loadFromJSON();
 
   if (!ok_) {
     qDebug() << "DataFile: failed to load " << fn;
     return;
   }
-  data_ = Data::create(v["typ"].toString());
-  ok_ = data_!=0;
-  if (!ok_) {
-    qDebug() << "DataFile: No creator for type "
-	     << v["typ"].toString();
+  if (!detached_)
+    connect(data_, SIGNAL(mod()), this, SLOT(saveSoon()));
+}
+
+bool DataFile0::isDetached() const {
+  return detached_;
+}
+
+void DataFile0::attach() {
+  if (!detached_)
     return;
+  detached_ = false;
+  if (data_)
+    connect(data_, SIGNAL(mod()), this, SLOT(saveSoon()));
+  if (needToSave_)
+    saveSoon();
+}
+
+bool DataFile0::loadFromJSON() {
+  /* Rather than building a QVariantMap of the whole file, we let the
+     parser drive the creation of our Data directly. */
+  QFile f(fn_);
+  if (!f.open(QFile::ReadOnly)) {
+    qDebug() << "DataFile: file not found";
+    return false;
+  }
+  QByteArray json;
+  qint64 len = f.size();
+  uchar *mapped = len>0 ? f.map(0, len) : 0;
+  if (mapped)
+    json = QByteArray::fromRawData((char const *)mapped, len);
+  else
+    json = f.readAll();
+  StartupProfile::countFile(len);
+
+  bool ok = false;
+  try {
+    DataLoader src(json);
+    DataLoader::Members mm = src.readMembers();
+    src.assertEnd();
+    QString typ = src.value(mm, "typ").toString();
+    data_ = Data::create(typ);
+    if (data_) {
+      data_->setParent(this); // just a QObject as a parent
+      data_->load(src, mm);
+      ok = true;
+    } else {
+      qDebug() << "DataFile: No creator for type " << typ;
+    }
+  } catch (JSONParser::Error const &e) {
+    e.report();
+    qDebug() << "(while reading: " << fn_ << ")";
+    delete data_;
   }
 
-  data_->setParent(this); // just a QObject as a parent
-  data_->load(v);
-  connect(data_, SIGNAL(mod()), this, SLOT(saveSoon()));
+  if (mapped)
+    f.unmap(mapped);
+  return ok;
 }
 
 DataFile0::DataFile0(Data *data, QString fn, QObject *parent):
@@ -61,7 +116,8 @@ DataFile0::DataFile0(Data *data, QString fn, QObject *parent):
   data_(data),
   fn_(fn),
   needToSave_(true),
-  saveTimer_(0) {
+  detached_(false),
+  pendingSave_(0) {
   ok_ = data_ != 0;
   ASSERT(data_);
   if (!ok_)
@@ -80,7 +136,13 @@ bool DataFile0::saveNow(bool force) {
     needToSave_ = true;
     
   if (!needToSave_) {
-    ok_ = data_!=0;
+    if (pendingSave_) {
+      quint64 serial = pendingSave_;
+      backgroundSaveDone(serial,
+                         BackgroundSaver::instance()->waitFor(serial));
+    } else {
+      ok_ = data_!=0;
+    }
     return ok_;
   }
   
@@ -88,51 +150,67 @@ bool DataFile0::saveNow(bool force) {
     return false;
   }
 
-  ok_ = JSONFile::save(data_->save(), fn_);  
-  if (ok_) {
-    needToSave_ = false;
+  saveInBackground();
+  quint64 serial = pendingSave_;
+  backgroundSaveDone(serial, BackgroundSaver::instance()->waitFor(serial));
+  return ok_;
+}
+
+void DataFile0::saveInBackground() {
+  if (!data_)
+    return;
+  /* Building the QVariantMap is the only part that must happen in the
+     GUI thread. Serialization and writing happen in the BackgroundSaver. */
+  pendingSave_ = BackgroundSaver::instance()->enqueue(this, fn_,
+                                                      data_->save());
+  needToSave_ = false;
+}
+
+void DataFile0::backgroundSaveDone(quint64 serial, bool ok) {
+  if (serial==pendingSave_)
+    pendingSave_ = 0;
+  ok_ = ok;
+  if (ok) {
+    if (!needToSave())
+      SaveScheduler::instance()->markClean(this);
     emit saved();
+  } else {
+    saveSoon(); // we'll have to try again
   }
-  return ok_;
 }
 
 bool DataFile0::needToSave() const {
-  return needToSave_;
+  return needToSave_ || pendingSave_;
 }
 
 void DataFile0::cancelSave() {
   needToSave_ = false;
+  if (pendingSave_) {
+    BackgroundSaver::instance()->cancel(pendingSave_);
+    pendingSave_ = 0;
+  }
+  if (!detached_)
+    SaveScheduler::instance()->markClean(this);
 }
   
 
 void DataFile0::saveSoon() {
-  if (!saveTimer_) {
-    saveTimer_ = new QTimer(this);
-    connect(saveTimer_, SIGNAL(timeout()),
-	    this, SLOT(saveTimerTimeout()));
-  }
-  
+  /* The actual saving happens in the SaveScheduler's next pass, together
+     with all other files that need saving. */
   needToSave_ = true;
-  if (!saveTimer_->isActive()) {
-    // saveTimer not active: activate it
-    saveTimer_->setSingleShot(true);
-    saveTimer_->start(int(saveDelay_s * 1e3));
-  }
-}
-
-void DataFile0::saveTimerTimeout() {
-  if (needToSave_) {
-    if (isBlocked())
-      saveWhenUnblocked();
-    else
-      saveNow();
-  }
+  if (detached_)
+    return; // attach() will take care of it
+  SaveScheduler::instance()->markDirty(this);
 }
 
 DataFile0::~DataFile0() {
+  if (detached_)
+    return; // never saved, by design
   if (needToSave_) {
     qDebug() << "DataFile0: Caution: DataFile0 destructed while waiting to save";
     saveNow();
+  } else if (pendingSave_) {
+    saveNow(); // let the background save complete
   }
 }
 
@@ -162,6 +240,10 @@ int &DataFile0::maxBlockDur() {
 
 void DataFile0::addBlocker(DFBlocker *b) {
   blockers().insert(b);
+  /* No new saves will start while we are blocked, but one may be in
+     progress. Let it finish, so that no file is half-way through being
+     replaced when, e.g., BackgroundVC starts committing. */
+  BackgroundSaver::instance()->waitForIdle();
 }
 
 void DataFile0::removeBlocker(DFBlocker *b) {
@@ -169,7 +251,8 @@ void DataFile0::removeBlocker(DFBlocker *b) {
   blockers().remove(b);
   if (wasBlocked && !isBlocked()) {
     foreach (DataFile0 *df, saveNeeders().toList<DataFile0>())
-      df->saveNow();
+      if (df->needToSave_)
+        df->saveInBackground();
     saveNeeders().clear();
   }
 }
@@ -190,7 +273,7 @@ void DataFile0::saveWhenUnblocked() {
   if (isBlocked())
     saveNeeders().insert(this);
   else
-    saveNow();
+    saveInBackground();
 }
 
 void DataFile0::dontSaveWhenUnblocked() {
@@ -31,27 +31,41 @@ public:  virtual ~DataFile0();
   bool saveNow(bool force=false);
   // Won't do anything if needToSave() is false, unless FORCE is set.
   // Returns true if ok, even if nothing was saved.
+  // Waits for any save that is still in progress in the background.
+  void saveInBackground();
+  // Takes a snapshot of the data and hands it to the BackgroundSaver.
   QString fileName() const;
-  bool needToSave() const;
+  bool needToSave() const; // also true while a background save is pending
+  bool isDetached() const;
+  void attach();
+  /* A file loaded detached never saves itself, and never talks to the
+     SaveScheduler or the BackgroundSaver, so it may be loaded, read, and
+     deleted in a worker thread. To keep it, move it to the GUI thread and
+     call attach() there; from then on it behaves like any other file. */
 public slots:
   void cancelSave();
   void saveSoon();
 public:
   static void setSaveDelay(double t_s);
+  static double saveDelay();
 signals:
   void saved();
 protected:
 public:
   DataFile0(Data *data, QString fn, QObject *parent=0); // creates
-  DataFile0(QString fn, QObject *parent=0); // loads
-private slots:
-  void saveTimerTimeout();
+  DataFile0(QString fn, QObject *parent=0, bool detached=false); // loads
+private:
+  bool loadFromJSON();
+  void backgroundSaveDone(quint64 serial, bool ok);
+  friend class BackgroundSaver;
+  friend class SaveScheduler;
 private:
   bool ok_;
   QPointer<Data> data_;
   QString fn_;
   bool needToSave_;
-  class QTimer *saveTimer_;
+  bool detached_;
+  quint64 pendingSave_; // serial number of background save, if any
   static double saveDelay_s;
 public:
   static void addBlocker(class DFBlocker *);
@@ -71,8 +85,8 @@ template <class T> class DataFile: public DataFile0 {
  protected:
   DataFile<T>(T *data, QString fn, QObject *parent=0):
     DataFile0(data, fn, parent) { }
-  DataFile<T>(QString fn, QObject *parent=0):
-    DataFile0(fn, parent) { }
+  DataFile<T>(QString fn, QObject *parent=0, bool detached=false):
+    DataFile0(fn, parent, detached) { }
  public:
   T *data() const { return dynamic_cast<T*>(DataFile0::data()); }
   static DataFile<T> *create(QString fn, QObject *parent=0) {
@@ -97,6 +111,14 @@ template <class T> class DataFile: public DataFile0 {
     delete df;
     return 0;
   }
+  static DataFile<T> *loadDetached(QString fn, QObject *parent=0) {
+    // See DataFile0::attach().
+    DataFile<T> *df = new DataFile<T>(fn, parent, true);
+    if (df->ok())
+      return df;
+    delete df;
+    return 0;
+  }
 };
 
 #endif
@@ -0,0 +1,216 @@
+// File/DataLoader.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// DataLoader.C
+
+#include "DataLoader.h"
+#include "StartupProfile.h"
+#include <QFile>
+#include <QDebug>
+
+DataLoader::DataLoader(QByteArray const &utf8): JSONByteParser(utf8) {
+}
+
+char const *DataLoader::position() const {
+  return ptr;
+}
+
+void DataLoader::seek(char const *pos) {
+  ptr = pos;
+}
+
+void DataLoader::skipNested() {
+  /* Skips an object or array by counting brackets. This does not check
+     the syntax of the contents; that happens when (if) they are parsed
+     for real. */
+  int depth = 0;
+  while (ptr<end) {
+    switch (*ptr++) {
+    case '"':
+      while (ptr<end && *ptr!='"') {
+        if (*ptr=='\\')
+          ++ptr;
+        ++ptr;
+      }
+      ++ptr;
+      break;
+    case '{': case '[':
+      depth++;
+      break;
+    case '}': case ']':
+      if (--depth==0) {
+        skipWhite();
+        return;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  if (ptr>end)
+    ptr = end;
+  assertNext(); // throws
+}
+
+void DataLoader::skipAny() {
+  switch (peekNext()) {
+  case '{': case '[':
+    skipNested();
+    break;
+  case '"':
+    ++ptr;
+    while (ptr<end && *ptr!='"') {
+      if (*ptr=='\\')
+        ++ptr;
+      ++ptr;
+    }
+    if (ptr>=end) {
+      ptr = end;
+      assertNext(); // throws
+    }
+    ++ptr;
+    skipWhite();
+    break;
+  default:
+    readValue("value, object, or array");
+  }
+}
+
+DataLoader::Members DataLoader::readMembers() {
+  Members mm;
+  if (getNext()!='{')
+    makeError("Not an object", true);
+  skipWhite();
+  if (conditionalReadLiteral("}", 1))
+    return mm;
+  while (true) {
+    QString key = readKey();
+    if (getNext()!=':')
+      makeError("Expected colon");
+    skipWhite();
+    mm.insert(key, ptr);
+    skipAny();
+    switch (getNext()) {
+    case '}':
+      skipWhite();
+      return mm;
+    case ',':
+      skipWhite();
+      continue;
+    default:
+      makeError("Expected comma or closing brace", true);
+    }
+  }
+  return mm; // not executed
+}
+
+QVariant DataLoader::value(Members const &mm, QString key) {
+  Members::const_iterator i = mm.constFind(key);
+  if (i==mm.constEnd())
+    return QVariant();
+  char const *here = ptr;
+  ptr = i.value();
+  QVariant v = readAny();
+  ptr = here;
+  return v;
+}
+
+QList<char const *> DataLoader::elements(Members const &mm, QString key) {
+  QList<char const *> res;
+  Members::const_iterator i = mm.constFind(key);
+  if (i==mm.constEnd())
+    return res;
+  char const *here = ptr;
+  ptr = i.value();
+  if (getNext()!='[')
+    makeError("Not an array", true);
+  skipWhite();
+  if (!conditionalReadLiteral("]", 1)) {
+    while (true) {
+      res << ptr;
+      skipAny();
+      char c = getNext();
+      if (c==']')
+        break;
+      else if (c!=',')
+        makeError("Expected comma or closing bracket", true);
+      skipWhite();
+    }
+  }
+  ptr = here;
+  return res;
+}
+
+QVariantMap DataLoader::readHeader() {
+  QVariantMap res;
+  if (getNext()!='{')
+    makeError("Not an object", true);
+  skipWhite();
+  if (conditionalReadLiteral("}", 1))
+    return res;
+  while (true) {
+    QString key = readKey();
+    if (key=="cc")
+      return res;
+    if (getNext()!=':')
+      makeError("Expected colon");
+    skipWhite();
+    res.insert(key, readAny());
+    switch (getNext()) {
+    case '}':
+      skipWhite();
+      return res;
+    case ',':
+      skipWhite();
+      continue;
+    default:
+      makeError("Expected comma or closing brace", true);
+    }
+  }
+  return res; // not executed
+}
+
+QVariantMap DataLoader::readHeader(QString fn, bool *ok) {
+  if (ok)
+    *ok = false;
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly)) {
+    qDebug() << "DataLoader::readHeader: file not found" << fn;
+    return QVariantMap();
+  }
+  QByteArray ba;
+  qint64 len = f.size();
+  uchar *mapped = len>0 ? f.map(0, len) : 0;
+  if (mapped)
+    ba = QByteArray::fromRawData((char const *)mapped, len);
+  else
+    ba = f.readAll();
+
+  QVariantMap res;
+  try {
+    DataLoader src(ba);
+    res = src.readHeader();
+    StartupProfile::countFile(src.position() - ba.constData());
+    if (ok)
+      *ok = true;
+  } catch (JSONParser::Error const &e) {
+    e.report();
+    qDebug() << "(while reading: " << fn << ")";
+  }
+  if (mapped)
+    f.unmap(mapped);
+  return res;
+}
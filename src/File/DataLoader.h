@@ -0,0 +1,62 @@
+// File/DataLoader.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// DataLoader.H
+
+#ifndef DATALOADER_H
+
+#define DATALOADER_H
+
+#include "JSONByteParser.h"
+#include <QMap>
+#include <QList>
+
+class DataLoader: public JSONByteParser {
+  /* A pull parser for loading Data trees without building a QVariantMap
+     of the whole file first. An object is read by noting where each of
+     its members starts; the values are only parsed when Data::load asks
+     for them. Children are loaded straight into newly created Data.
+     Errors are reported by throwing a JSONParser::Error. */
+public:
+  typedef QMap<QString, char const *> Members;
+public:
+  DataLoader(QByteArray const &utf8);
+  Members readMembers();
+  /* Reads an object, recording the position of each member's value
+     without parsing it. Leaves the read position after the object. */
+  QVariant value(Members const &mm, QString key);
+  /* Parses the value of a member, or returns an invalid QVariant if
+     there is no such member. Does not change the read position. */
+  QList<char const *> elements(Members const &mm, QString key);
+  /* Returns the positions of the elements of an array-valued member.
+     Does not change the read position. */
+  QVariantMap readHeader();
+  /* Reads the members of an object up to, but not including, its
+     children ("cc"). Because JSONFile always writes "cc" last, this
+     normally yields everything but the children, at a cost proportional
+     to the size of the header rather than of the whole object. */
+  static QVariantMap readHeader(QString fn, bool *ok=0);
+  /* Convenience function that reads the header of a file. Only the
+     parts of the file that are actually read are mapped into memory. */
+  char const *position() const;
+  void seek(char const *pos);
+protected:
+  void skipAny();
+private:
+  void skipNested();
+};
+
+#endif
@@ -35,7 +35,7 @@ EntryFile *createEntry(QDir const &dir, int n, QObject *parent) {
     return 0;
   f->data()->setUuid(uuid);
   ResManager *r = new ResManager(f->data());
-  QString resfn = dir.absoluteFilePath(fn0 + ".res");
+  QString resfn = pfn.left(pfn.size() - 5) + ".res"; // replace ".json"
   r->setRoot(resfn);
   return f;
 }
@@ -72,19 +72,36 @@ bool deleteEntryFile(QDir dir, int n, QString uuid) {
 }
 
 
-EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent) {
+QString entryFileName(QDir const &dir, int n, QString uuid) {
   QString fn0 = basicFilename(n, uuid);
   if (!dir.exists(fn0 + ".json"))
     fn0 = QString::number(n); // quietly revert to old style
-  QString pfn = dir.absoluteFilePath(fn0 + ".json");
-  EntryFile *f = EntryFile::load(pfn, parent);
-  if (!f)
-    return 0;
+  return dir.absoluteFilePath(fn0 + ".json");
+}
 
+static void setupResManager(EntryFile *f) {
   ResManager *r = f->data()->resManager();
   if (!r)
-    r = new ResManager(f->data());
-  QString resfn = dir.absoluteFilePath(fn0 + ".res");
+    r = new ResManager(f->data()); // this makes the file need saving
+  QString pfn = f->fileName();
+  QString resfn = pfn.left(pfn.size() - 5) + ".res"; // replace ".json"
   r->setRoot(resfn);
+}
+
+EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent) {
+  QString pfn = entryFileName(dir, n, uuid);
+  EntryFile *f = EntryFile::load(pfn, parent);
+  if (!f)
+    return 0;
+  setupResManager(f);
   return f;
 }
+
+EntryFile *loadEntryDetached(QDir const &dir, int n, QString uuid) {
+  return EntryFile::loadDetached(entryFileName(dir, n, uuid));
+}
+
+void attachEntry(EntryFile *f) {
+  f->attach();
+  setupResManager(f);
+}
@@ -30,6 +30,14 @@ EntryFile *createEntry(QDir const &dir, int n, QObject *parent=0);
 /* createEntry returns NULL if the file cannot be created */
 EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent=0);
 /* loadEntry returns NULL if the file cannot be found */
+EntryFile *loadEntryDetached(QDir const &dir, int n, QString uuid);
+/* loadEntryDetached is like loadEntry, but may be called in a worker
+   thread. The file is detached (see DataFile0::attach) and its resource
+   manager is not yet set up. */
+void attachEntry(EntryFile *f);
+/* attachEntry completes loadEntryDetached, in the GUI thread. */
+QString entryFileName(QDir const &dir, int n, QString uuid);
+/* entryFileName returns the absolute path of the JSON file for an entry */
 
 bool deleteEntryFile(QDir dir, int n, QString uuid);
 
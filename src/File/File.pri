@@ -1,41 +1,51 @@
 # Automatically generated by updatesources.sh
 
 HEADERS += \
+     File/BackgroundSaver.h  \
      File/BackgroundVC.h  \
      File/BookFile.h  \
      File/CachedEntry.h  \
      File/DataFile.h  \
+     File/DataLoader.h  \
      File/DefaultLocation.h  \
      File/DFBlocker.h  \
      File/Downloader.h  \
      File/EntryFile.h  \
      File/Entry.h  \
+     File/JSONByteParser.h  \
      File/JSONFile.h  \
      File/JSONParser.h  \
      File/LateNoteFile.h  \
      File/LateNoteManager.h  \
+     File/PageCache.h  \
      File/PointerSet.h  \
      File/ResLoader.h  \
      File/RmDir.h  \
+     File/SaveScheduler.h  \
      File/SmartURL.h  \
      File/SvgFile.h  \
      File/VersionControl.h  \
 
 SOURCES += \
+     File/BackgroundSaver.cpp  \
      File/BackgroundVC.cpp  \
      File/CachedEntry.cpp  \
      File/DataFile.cpp  \
+     File/DataLoader.cpp  \
      File/DFBlocker.cpp  \
      File/Downloader.cpp  \
      File/Entry.cpp  \
      File/EntryFile.cpp  \
+     File/JSONByteParser.cpp  \
      File/JSONFile.cpp  \
      File/JSONParser.cpp  \
      File/LateNoteFile.cpp  \
      File/LateNoteManager.cpp  \
+     File/PageCache.cpp  \
      File/PointerSet.cpp  \
      File/ResLoader.cpp  \
      File/RmDir.cpp  \
+     File/SaveScheduler.cpp  \
      File/SvgFile.cpp  \
      File/VersionControl.cpp  \
 
@@ -0,0 +1,384 @@
+// File/JSONByteParser.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONByteParser.C
+
+#include "JSONByteParser.h"
+#include <QDebug>
+#include <string.h>
+
+static inline bool isLetterOrNumber(char c) {
+  unsigned char u = c;
+  return (u>='0' && u<='9') || (u>='a' && u<='z') || (u>='A' && u<='Z')
+    || u>=0x80; // anything non-ASCII may well be a letter
+}
+
+static inline bool isStringSpecial(char c) {
+  // True for characters that end a plain run inside a string
+  unsigned char u = c;
+  return u=='"' || u=='\\' || u<' ';
+}
+
+JSONByteParser::JSONByteParser(QByteArray const &utf8): input(utf8) {
+  begin = input.constData();
+  ptr = begin;
+  end = begin + input.size();
+  if (end-ptr>=3 && memcmp(ptr, "\xef\xbb\xbf", 3)==0)
+    ptr += 3; // skip byte order mark, as QTextStream would
+}
+
+void JSONByteParser::makeError(QString msg, bool atPrev) const {
+  /* We do not keep track of line numbers while parsing, because errors
+     are rare. Instead, we count lines only when we need to report. */
+  int l = 1;
+  char const *lineStart = begin;
+  for (char const *p = begin; p<ptr; ++p) {
+    if (*p=='\n' || *p=='\r') {
+      l++;
+      if (p+1<ptr && p[0] + p[1] == '\n' + '\r')
+        ++p;
+      lineStart = p + 1;
+    }
+  }
+  int c = QString::fromUtf8(lineStart, ptr-lineStart).size();
+  if (atPrev)
+    if (--c<0)
+      l--;
+  throw JSONParser::Error(msg, l, c);
+}
+
+bool JSONByteParser::conditionalReadLiteral(char const *s, int n) {
+  if (end-ptr>=n && memcmp(ptr, s, n)==0) {
+    ptr += n;
+    if (atEnd())
+      return true;
+    if (isLetterOrNumber(*ptr))
+      makeError("Bad termination of literal value");
+    skipWhite();
+    return true;
+  } else {
+    return false;
+  }
+}
+
+bool JSONByteParser::atEnd() const throw() {
+  return ptr>=end;
+}
+
+void JSONByteParser::assertEnd() const {
+  if (!atEnd())
+    makeError("Expected EOF");
+}
+
+void JSONByteParser::assertNext() const {
+  if (atEnd())
+    makeError("Unexpected EOF");
+}
+
+char JSONByteParser::peekNext() const {
+  assertNext();
+  char r = *ptr;
+  if (r=='\r')
+    r = '\n';
+  return r;
+}
+
+char JSONByteParser::getNext() {
+  assertNext();
+  char r = *ptr++;
+  if (r=='\n' || r=='\r') {
+    if (!atEnd() && *ptr + r == '\n' + '\r')
+      ++ptr;
+    r = '\n';
+  }
+  return r;
+}
+
+void JSONByteParser::skipWhite() throw() {
+  while (ptr<end) {
+    switch (*ptr) {
+    case ' ': case '\t': case '\n': case '\r':
+      ++ptr;
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+bool JSONByteParser::scanString(char const *&start, int &len) {
+  /* Scans a string up to the closing quote. If the string contains no
+     escapes, returns true and sets START and LEN to the raw contents.
+     Otherwise, returns false, with START pointing to the contents and
+     the read pointer at the first backslash. */
+  if (getNext()!='"')
+    makeError("Expected a string", true);
+  start = ptr;
+  while (ptr<end) {
+    if (!isStringSpecial(*ptr)) {
+      ++ptr;
+      continue;
+    }
+    switch (*ptr) {
+    case '"':
+      len = ptr - start;
+      ++ptr;
+      skipWhite();
+      return true;
+    case '\\':
+      return false;
+    default:
+      ++ptr;
+      makeError("Illegal control char inside string", true);
+    }
+  }
+  assertNext();
+  return false; // not executed
+}
+
+QString JSONByteParser::decodeEscapedString(char const *start) {
+  /* Multibyte UTF-8 sequences never contain '"' or '\\', so it is safe
+     to decode the runs between escapes separately. */
+  QString res;
+  res.reserve(ptr - start + 16);
+  char const *run = start;
+  while (true) {
+    while (ptr<end && !isStringSpecial(*ptr))
+      ++ptr;
+    assertNext();
+    if (ptr>run)
+      res += QString::fromUtf8(run, ptr-run);
+    char c = *ptr++;
+    if (c=='"')
+      break;
+    if (c!='\\')
+      makeError("Illegal control char inside string", true);
+    assertNext();
+    switch (*ptr++) {
+    case 'b': res += '\b'; break;
+    case 'f': res += '\f'; break;
+    case 'n': res += '\n'; break;
+    case 'r': res += '\r'; break;
+    case 't': res += '\t'; break;
+    case '\\': res += '\\'; break;
+    case '/': res += '/'; break;
+    case '"': res += '"'; break;
+    case 'u': {
+      ushort a = 0;
+      for (int k=0; k<4; k++) {
+        assertNext();
+        char x = *ptr++;
+        a <<= 4;
+        if (x>='0' && x<='9')
+          a += x - '0';
+        else if (x>='A' && x<='F')
+          a += 10 + x - 'A';
+        else if (x>='a' && x<='f')
+          a += 10 + x - 'a';
+        else
+          makeError("Expected a hex digit", true);
+      }
+      res += QChar(a);
+    } break;
+    default:
+      makeError("Unexpected character after backslash", true);
+    }
+    run = ptr;
+  }
+  skipWhite();
+  return res;
+}
+
+QString JSONByteParser::readString() {
+  char const *start;
+  int len;
+  if (!scanString(start, len))
+    return decodeEscapedString(start);
+  return QString::fromUtf8(start, len);
+}
+
+QString JSONByteParser::readKey() {
+  char const *start;
+  int len;
+  if (!scanString(start, len))
+    return decodeEscapedString(start);
+  QByteArray raw(QByteArray::fromRawData(start, len));
+  QHash<QByteArray, QString>::const_iterator i = keys.constFind(raw);
+  if (i!=keys.constEnd())
+    return i.value();
+  QString key = QString::fromUtf8(start, len);
+  keys.insert(QByteArray(start, len), key);
+  return key;
+}
+
+QVariant JSONByteParser::readNumber() {
+  char const *start = ptr;
+  bool isInt = true;
+  while (ptr<end) {
+    char next = *ptr;
+    if (next>='0' && next<='9') {
+      ++ptr;
+    } else if (next=='e' || next=='E' || next=='.'
+               || next=='+' || next=='-') {
+      isInt = false; // as in JSONParser, negative numbers are read as double
+      ++ptr;
+    } else {
+      break;
+    }
+  }
+  int len = ptr - start;
+  if (len==0 || (!atEnd() && isLetterOrNumber(*ptr)))
+    makeError("Expected a number");
+
+  skipWhite();
+
+  if (isInt) {
+    if (len<=9) {
+      // cannot overflow, so we can do this ourselves
+      int v = 0;
+      for (char const *p=start; p<start+len; ++p)
+        v = 10*v + (*p - '0');
+      return QVariant(v);
+    }
+    return QVariant(QByteArray(start, len).toInt());
+  }
+  bool ok;
+  double v = QByteArray(start, len).toDouble(&ok);
+  if (!ok)
+    makeError("Expected a number");
+  return QVariant(v);
+}
+
+QVariant JSONByteParser::readValue(char const *exp) {
+  char c = peekNext();
+  if (c=='"')
+    return QVariant(readString());
+  else if (c=='-' || (c>='0' && c<='9'))
+    return readNumber();
+  else if (conditionalReadLiteral("false", 5))
+    return QVariant(false);
+  else if (conditionalReadLiteral("true", 4))
+    return QVariant(true);
+  else if (conditionalReadLiteral("null", 4))
+    return QVariant();
+  else
+    makeError(QString("Expected a ") + exp, false);
+  return QVariant(); // not executed
+}
+
+QVariantMap JSONByteParser::readObject() {
+  if (getNext()!='{')
+    makeError("Not an object", true);
+  skipWhite();
+  QVariantMap res;
+  if (conditionalReadLiteral("}", 1))
+    return res;
+  while (true) {
+    QString key = readKey();
+    if (getNext()!=':')
+      makeError("Expected colon");
+    skipWhite();
+    res.insert(key, readAny());
+    switch (getNext()) {
+    case '}':
+      skipWhite();
+      return res;
+    case ',':
+      skipWhite();
+      continue;
+    default:
+      makeError("Expected comma or closing brace", true);
+    }
+  }
+  return res; // not executed
+}
+
+QVariantList JSONByteParser::readArray() {
+  if (getNext()!='[')
+    makeError("Not an array", true);
+  skipWhite();
+  QVariantList res;
+  if (conditionalReadLiteral("]", 1))
+    return res;
+  while (true) {
+    res.append(readAny());
+    switch (getNext()) {
+    case ']':
+      skipWhite();
+      return res;
+    case ',':
+      skipWhite();
+      continue;
+    default:
+      makeError("Expected comma or closing bracket", true);
+    }
+  }
+  return res; // not reached
+}
+
+QVariant JSONByteParser::readAny() {
+  switch (peekNext()) {
+  case '{':
+    return QVariant(readObject());
+  case '[':
+    return QVariant(readArray());
+  default:
+    return readValue("value, object, or array");
+  }
+}
+
+#if 0
+// Benchmark: compare against JSONParser on a large generated index.json
+#include "JSONFile.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QTextStream>
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QVariantMap idx;
+  for (int w=0; w<100000; w++) {
+    QVariantList pgs;
+    for (int k=0; k<1 + w%37; k++)
+      pgs << QVariant((w*7 + k*13) % 5000);
+    idx[QString("w%1é%2").arg(w).arg(w%97)] = QVariant(pgs);
+  }
+  QVariantMap ls;
+  for (int pg=1; pg<5000; pg++)
+    ls[QString::number(pg)] = QVariant(QDateTime::currentDateTime());
+  QVariantMap top;
+  top["vsn no"] = 1;
+  top["index"] = idx;
+  top["ls"] = ls;
+  QByteArray ba = JSONFile::write(top, true).toUtf8();
+  qDebug() << "Input size:" << ba.size() << "bytes";
+
+  QElapsedTimer t;
+  t.start();
+  QTextStream ts(&ba, QIODevice::ReadOnly);
+  ts.setCodec("UTF-8");
+  QVariantMap v0 = JSONParser(ts.readAll()).readObject();
+  qDebug() << "JSONParser:" << t.elapsed() << "ms";
+
+  t.restart();
+  QVariantMap v1 = JSONByteParser(ba).readObject();
+  qDebug() << "JSONByteParser:" << t.elapsed() << "ms";
+
+  qDebug() << "Identical:" << (v0==v1);
+  return 0;
+}
+#endif
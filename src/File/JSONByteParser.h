@@ -0,0 +1,68 @@
+// File/JSONByteParser.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONByteParser.H
+
+#ifndef JSONBYTEPARSER_H
+
+#define JSONBYTEPARSER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+#include <QHash>
+#include "JSONParser.h"
+
+class JSONByteParser {
+  /* A JSON parser that works directly on UTF-8 encoded bytes, as read from
+     (or mapped from) a file. It produces the same results as JSONParser,
+     but avoids decoding the entire input to a QString first. Only string
+     values are ever decoded, and they are decoded in bulk.
+     Errors are reported by throwing a JSONParser::Error.
+     The input must remain valid for the lifetime of the parser. */
+public:
+  JSONByteParser(QByteArray const &utf8);
+  bool atEnd() const throw();
+  QVariantMap readObject();
+  QVariantList readArray();
+  QVariant readAny();
+  void assertEnd() const;
+protected:
+  QString readString();
+  QString readKey();
+  bool scanString(char const *&start, int &len);
+  QVariant readNumber();
+  QVariant readValue(char const *exp="value");
+  void skipWhite() throw();
+  char peekNext() const;
+  char getNext();
+  bool conditionalReadLiteral(char const *s, int n);
+  void assertNext() const;
+  void makeError(QString msg, bool atPrev=false) const;
+private:
+  QString decodeEscapedString(char const *start);
+protected:
+  QByteArray input;
+  char const *begin;
+  char const *ptr;
+  char const *end;
+private:
+  QHash<QByteArray, QString> keys;
+  /* Keys are repeated throughout the files we read ("typ", "cre", "cc",
+     etc.), so we keep one copy of each and let QString share the data. */
+};
+
+#endif
@@ -18,9 +18,21 @@
 
 #include "JSONFile.h"
 #include <QFile>
+#include <QBuffer>
+#include <QDir>
 #include <QDebug>
 
 #include "JSONParser.h"
+#include "JSONByteParser.h"
+#include "StartupProfile.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <stdio.h>
+#endif
   
 
 namespace JSONFile {
@@ -49,30 +61,63 @@ namespace JSONFile {
   * Boston, MA 02110-1301, USA.
   */
   class Serializer {
+    /* Writes UTF-8 straight into a device. Output is collected in a
+       modest buffer that is handed to the device whenever it fills up,
+       so nested maps and lists are never built as temporary strings. */
   public:
-    Serializer(bool compact=false): compact(compact) { }
-    QString serializeMap(QVariantMap const &v,
-                         int indent, bool parentIsArray);  
-    QString serializeList(QVariantList const &v,
-                          int indent, bool parentIsArray);
-    QString serializeString(QString s);
-    QString serializeDouble(double v);
-    QString serialize(QVariant v,
-                      int indent=0, bool parentIsArray=false);
+    Serializer(QIODevice *dest, bool compact=false):
+      dest(dest), compact(compact), ok(true) {
+      buf.reserve(BufSize + 1024);
+    }
+    void serializeMap(QVariantMap const &v, int indent, bool parentIsArray);
+    void serializeList(QVariantList const &v, int indent, bool parentIsArray);
+    void serializeString(QString const &s);
+    void serializeDouble(double v);
+    void serialize(QVariant const &v, int indent=0, bool parentIsArray=false);
+    bool flush(); // returns true if everything was written OK
   private:
+    void put(char c) { buf += c; }
+    void put(char const *s) { buf += s; }
+    void put(QByteArray const &s) { buf += s; }
+    void putNewline(int indent); // newline followed by indentation
+    void flushIfFull() { if (buf.size()>=BufSize) flush(); }
+  private:
+    static const int BufSize = 65536;
+    QIODevice *dest;
     bool compact;
+    bool ok;
+    QByteArray buf;
   };
 
-  QString Serializer::serializeMap(QVariantMap const &v,
-                                   int indent, bool parentIsArray) {
-    if (v.isEmpty())
-      return compact ? "{}" : "{ }";
-    QString ind = "";
-    if (!compact) 
-      for (int k=0; k<indent; k++)
-        ind += "  ";
-    QString s = compact ? "{"
-      : (parentIsArray ? "{ " : "{\n" + ind + "  ");
+  bool Serializer::flush() {
+    if (!buf.isEmpty()) {
+      if (dest->write(buf) != buf.size())
+        ok = false;
+      buf.resize(0); // keeps the allocation
+    }
+    return ok;
+  }
+
+  void Serializer::putNewline(int indent) {
+    buf += '\n';
+    for (int k=0; k<indent; k++)
+      buf += "  ";
+  }
+
+  void Serializer::serializeMap(QVariantMap const &v,
+                                int indent, bool parentIsArray) {
+    if (v.isEmpty()) {
+      put(compact ? "{}" : "{ }");
+      return;
+    }
+    if (compact) {
+      put('{');
+    } else if (parentIsArray) {
+      put("{ ");
+    } else {
+      put('{');
+      putNewline(indent+1);
+    }
     bool first = true;
     QList<QString> kk = v.keys();
     // do a little reordering
@@ -84,83 +129,128 @@ namespace JSONFile {
       kk.insert(0, "typ");
     if (kk.removeOne("cc"))
       kk.append("cc");
-    foreach (QString k, kk) {
-      if (first)
+    foreach (QString const &k, kk) {
+      if (first) {
 	first = false;
-      else
-	s += compact ? ",\n" : (",\n" + ind + "  ");
-      s += serializeString(k);
-      s += compact ? ":" : ": ";
-      QString s1 = serialize(v[k], indent+1, false);
-      // lastML = s1.contains("\n");
-      s += s1;
+      } else if (compact) {
+	put(",\n");
+      } else {
+        put(',');
+        putNewline(indent+1);
+      }
+      serializeString(k);
+      put(compact ? ":" : ": ");
+      serialize(v.value(k), indent+1, false);
+      flushIfFull();
     }
-    s += compact ? "}" : ("\n" + ind + "}");
-    return s;
+    if (!compact)
+      putNewline(indent);
+    put('}');
   }
 
-  QString Serializer::serializeList(QVariantList const &v,
-                                    int indent, bool parentIsArray) {
-    if (v.isEmpty())
-      return compact ? "[]" : "[ ]";
-    QString ind = "";
-    if (!compact)
-      for (int k=0; k<indent; k++)
-        ind += "  ";
-    QString s = compact ? "[" : (parentIsArray ? "[ " : "[\n" + ind + "  ");
+  void Serializer::serializeList(QVariantList const &v,
+                                 int indent, bool parentIsArray) {
+    if (v.isEmpty()) {
+      put(compact ? "[]" : "[ ]");
+      return;
+    }
+    if (compact) {
+      put('[');
+    } else if (parentIsArray) {
+      put("[ ");
+    } else {
+      put('[');
+      putNewline(indent+1);
+    }
     bool first = true;
-    foreach (QVariant k, v) {
-      if (first)
+    foreach (QVariant const &k, v) {
+      if (first) {
 	first = false;
-      else
-	s += compact ? "," : (",\n" + ind + "  ");
-      QString s1 = serialize(k, indent+1, true);
-      s += s1;
+      } else if (compact) {
+	put(',');
+      } else {
+        put(',');
+        putNewline(indent+1);
+      }
+      serialize(k, indent+1, true);
+      flushIfFull();
     }
-    s += compact ? "]" : ("\n" + ind + "]");
-    return s;
+    if (!compact)
+      putNewline(indent);
+    put(']');
   }
 
-  QString Serializer::serializeString(QString s) {
-    s.replace("\\", "\\\\");
-    s.replace("\"", "\\\"");
-    s.replace("\b", "\\b");
-    s.replace("\f", "\\f");
-    s.replace("\n", "\\n");
-    s.replace("\r", "\\r");
-    s.replace("\t", "\\t");
-    return "\"" + s + "\"";
+  void Serializer::serializeString(QString const &s) {
+    /* Escapes and encodes as UTF-8 in a single pass. Unpaired surrogates
+       become '?', exactly as QString::toUtf8() would have it. */
+    int n = s.size();
+    QChar const *d = s.constData();
+    buf += '"';
+    for (int i=0; i<n; i++) {
+      ushort u = d[i].unicode();
+      if (u<0x80) {
+        switch (u) {
+        case '\\': buf += "\\\\"; break;
+        case '"': buf += "\\\""; break;
+        case '\b': buf += "\\b"; break;
+        case '\f': buf += "\\f"; break;
+        case '\n': buf += "\\n"; break;
+        case '\r': buf += "\\r"; break;
+        case '\t': buf += "\\t"; break;
+        default: buf += char(u); break;
+        }
+      } else if (u<0x800) {
+        buf += char(0xc0 | (u>>6));
+        buf += char(0x80 | (u & 0x3f));
+      } else if (QChar::isHighSurrogate(u)) {
+        if (i+1<n && d[i+1].isLowSurrogate()) {
+          uint ucs4 = QChar::surrogateToUcs4(u, d[++i].unicode());
+          buf += char(0xf0 | (ucs4>>18));
+          buf += char(0x80 | ((ucs4>>12) & 0x3f));
+          buf += char(0x80 | ((ucs4>>6) & 0x3f));
+          buf += char(0x80 | (ucs4 & 0x3f));
+        } else {
+          buf += '?';
+        }
+      } else if (QChar::isLowSurrogate(u)) {
+        buf += '?';
+      } else {
+        buf += char(0xe0 | (u>>12));
+        buf += char(0x80 | ((u>>6) & 0x3f));
+        buf += char(0x80 | (u & 0x3f));
+      }
+    }
+    buf += '"';
   }
 
-  QString Serializer::serializeDouble(double d) {
-    QString s = QString::number(d);
-    if (!s.contains(".") && !s.contains("e"))
+  void Serializer::serializeDouble(double d) {
+    QByteArray s = QByteArray::number(d); // same format as QString::number
+    if (!s.contains('.') && !s.contains('e'))
       s += ".0";
-    return s;
+    put(s);
   }
   
-  QString Serializer::serialize(QVariant v, int indent, bool parentIsArray) {
+  void Serializer::serialize(QVariant const &v,
+                             int indent, bool parentIsArray) {
     if (!v.isValid())
-      return QString(); // invalid
+      return; // invalid
     if (v.type()==QVariant::List) 
-      return serializeList(v.toList(), indent, parentIsArray);
+      serializeList(v.toList(), indent, parentIsArray);
     else if (v.type()==QVariant::Map)
-      return serializeMap(v.toMap(), indent, parentIsArray);
+      serializeMap(v.toMap(), indent, parentIsArray);
     else if (v.type()==QVariant::String || v.type()==QVariant::ByteArray)
-      return serializeString(v.toString());
+      serializeString(v.toString());
     else if (v.type()==QVariant::Double)
-      return serializeDouble(v.toDouble());
+      serializeDouble(v.toDouble());
     else if (v.type()==QVariant::Bool)
-      return v.toBool() ? "true" : "false";
+      put(v.toBool() ? "true" : "false");
     else if (v.type() == QVariant::ULongLong )
-      return QString::number(v.value<qulonglong>());
+      put(QByteArray::number(v.value<qulonglong>()));
     else if (v.canConvert<qlonglong>())
-      return QString::number(v.value<qlonglong>());
+      put(QByteArray::number(v.value<qlonglong>()));
     else if (v.canConvert<QString>())
       // this will catch QDate, QDateTime, QUrl, ...
-      return serializeString(v.toString());
-    else
-      return QString();
+      serializeString(v.toString());
   }
 
   /* End of adapted section. The rest of this file was written by Daniel Wagenaar. */
@@ -174,10 +264,22 @@ namespace JSONFile {
       return QVariantMap();
     }
 
+    /* We parse the UTF-8 bytes directly rather than decoding the whole
+       file through a QTextStream first. Where possible, we map the file
+       rather than reading it. (Compressed resources cannot be mapped.) */
+    QByteArray ba;
+    qint64 len = f.size();
+    uchar *mapped = len>0 ? f.map(0, len) : 0;
+    if (mapped)
+      ba = QByteArray::fromRawData((char const *)mapped, len);
+    else
+      ba = f.readAll();
+    StartupProfile::countFile(len);
+
     bool ok1;
-    QTextStream ts(&f);
-    ts.setCodec("UTF-8");
-    QVariantMap res = read(ts.readAll(), &ok1);
+    QVariantMap res = readUtf8(ba, &ok1);
+    if (mapped)
+      f.unmap(mapped);
     if (!ok1) 
       qDebug() << "(while reading: " << fn << ")";
     if (ok)
@@ -185,6 +287,22 @@ namespace JSONFile {
     return res;
   }
 
+  QVariantMap readUtf8(QByteArray const &json, bool *ok) {
+    if (ok)
+      *ok = false;
+    JSONByteParser parser(json);
+    try {
+      QVariantMap v = parser.readObject();
+      parser.assertEnd();
+      if (ok)
+	*ok = true;
+      return v;
+    } catch (JSONParser::Error const &e) {
+      e.report();
+      return QVariantMap();
+    }
+  }
+
   QVariantMap read(QString json, bool *ok) {
     if (ok)
       *ok = false;
@@ -201,60 +319,89 @@ namespace JSONFile {
     }
   }
 
+  bool write(QVariantMap const &src, QIODevice *dest, bool compact) {
+    /* Note that the serializer currently only handles
+
+       bool, int (any size), double (and float), QString, QByteArray,
+
+       and lists and maps of any depth, as long as the terminal types are
+       restricted to those listed above.
+       In addition, anything that QVariant can convert to a QString is
+       supported. That includes QDateTime, QUrl, and some others.
+       However, QPoint, QFont, etc., are not supported.
+    */
+    Serializer s(dest, compact);
+    s.serialize(src, 0, true);
+    return s.flush();
+  }
+
   QString write(QVariantMap const &src, bool compact) {
-    Serializer s(compact);
-    return s.serialize(src, 0, true);
+    QBuffer buf;
+    buf.open(QBuffer::WriteOnly);
+    write(src, &buf, compact);
+    return QString::fromUtf8(buf.data());
   }
   
-  bool save(QVariantMap const &src, QString fn, bool compact) {
-    //    QJson::Serializer s;
-    //    QByteArray ba = s.serialize(QVariant(src));
-    Serializer s(compact);
-    QByteArray ba = s.serialize(src, 0, true).toUtf8();
-    if (ba.isEmpty()) {  
-      qDebug() << "DataFile0: Serialization failed";
+  static bool syncToDisk(QFile &f) {
+    if (!f.flush())
       return false;
-      /* Note that the serializer currently only handles
-
-         bool, int (any size), double (and float), QString, QByteArray,
+#ifdef Q_OS_WIN
+    return _commit(f.handle())==0;
+#else
+    return ::fsync(f.handle())==0;
+#endif
+  }
 
-	 and lists and maps of any depth, as long as the terminal types are
-	 restricted to those listed above.
-	 In addition, anything that QVariant can convert to a QString is
-	 supported. That includes QDateTime, QUrl, and some others.
-	 However, QPoint, QFont, etc., are not supported.
-	 Qt5 will have native JSON support, and I will likely switch to
-	 using that eventually.
-      */
-    
-      /* As an aside, I discovered that the serializer puts a binary length
-	 marker in front of the json data if it writes directly to file. */
-    }
-    ba += "\n";
-  
-    QFile f(fn);
-  
-    if (f.exists()) {
-      QString fn0 = fn + "~";
-      QFile f0(fn0);
-      if (f0.exists())
-	f0.remove();
-      f.rename(fn0);
-      f.setFileName(fn);
-    }
+  static bool replaceFile(QString tmpfn, QString fn) {
+    /* Moves TMPFN into the place of FN, keeping the previous version of
+       FN as FN~. At no point is FN missing from the disk. */
+    QString fn0 = fn + "~";
+    QFile::remove(fn0);
+#ifdef Q_OS_WIN
+    if (!QFile::exists(fn))
+      return QFile::rename(tmpfn, fn);
+    return ReplaceFileW((wchar_t const *)QDir::toNativeSeparators(fn).utf16(),
+                        (wchar_t const *)QDir::toNativeSeparators(tmpfn)
+                        .utf16(),
+                        (wchar_t const *)QDir::toNativeSeparators(fn0).utf16(),
+                        REPLACEFILE_IGNORE_MERGE_ERRORS, 0, 0);
+#else
+    if (QFile::exists(fn)
+        && ::link(QFile::encodeName(fn).constData(),
+                  QFile::encodeName(fn0).constData())!=0)
+      QFile::copy(fn, fn0); // e.g., no hard links on this file system
+    return ::rename(QFile::encodeName(tmpfn).constData(),
+                    QFile::encodeName(fn).constData())==0;
+#endif
+  }
   
+  bool save(QVariantMap const &src, QString fn, bool compact) {
+    /* We write to a temporary file, make sure it has reached the disk,
+       and only then move it into place. That way, a crash at any point
+       leaves either the old or the new version. The name of the temporary
+       ends in "~", so version control ignores it. */
+    QString tmpfn = fn + ".new~";
+    QFile f(tmpfn);
     if (!f.open(QFile::WriteOnly)) {
       qDebug() << "JSONFile: Cannot open file for writing";
       return false;
     }
 
-    if (f.write(ba) != ba.size()) {
+    if (!write(src, &f, compact) || f.write("\n", 1) != 1
+        || !syncToDisk(f)) {
       qDebug() << "JSONFile: Failed to write all contents";
+      f.close();
+      f.remove();
       return false;
     }
 
     f.close();
 
+    if (!replaceFile(tmpfn, fn)) {
+      qDebug() << "JSONFile: Failed to replace" << fn;
+      return false;
+    }
+
     return true;
   }
 };
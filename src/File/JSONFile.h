@@ -25,8 +25,12 @@
 namespace JSONFile {
   QVariantMap load(QString fn, bool *ok=0);
   QVariantMap read(QString json, bool *ok=0);
+  QVariantMap readUtf8(QByteArray const &json, bool *ok=0);
   bool save(QVariantMap const &src, QString fn, bool compact=false);
   QString write(QVariantMap const &src, bool compact=false);
+  bool write(QVariantMap const &src, class QIODevice *dest,
+             bool compact=false);
+  /* Streams UTF-8 straight into DEST, which must be open for writing. */
 };
 
 #endif
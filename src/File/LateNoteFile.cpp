@@ -27,10 +27,12 @@ LateNoteFile *createLateNoteFile(QDir const &dir, QObject *parent) {
   return f;
 }
 
-LateNoteFile *loadLateNoteFile(QDir const &dir, QString uuid, QObject *parent) {
+LateNoteFile *loadLateNoteFile(QDir const &dir, QString uuid, QObject *parent,
+                               bool detached) {
   QString fn0 = basicFilename(uuid);
   QString pfn = dir.absoluteFilePath(fn0 + ".json");
-  LateNoteFile *f = LateNoteFile::load(pfn, parent);
+  LateNoteFile *f = detached ? LateNoteFile::loadDetached(pfn, parent)
+    : LateNoteFile::load(pfn, parent);
   if (!f)
     return 0;
 
@@ -12,8 +12,10 @@
 typedef DataFile<LateNoteData> LateNoteFile;
 LateNoteFile *createLateNoteFile(QDir const &dir, QObject *parent=0);
 /* returns NULL if the file cannot be created */
-LateNoteFile *loadLateNoteFile(QDir const &dir, QString uuid, QObject *parent=0);
+LateNoteFile *loadLateNoteFile(QDir const &dir, QString uuid, QObject *parent=0,
+                               bool detached=false);
 /* returns NULL if the file cannot be found */
+/* If DETACHED, see DataFile0::attach. */
 
 bool deleteLateNoteFile(QDir dir, QString uuid);
 
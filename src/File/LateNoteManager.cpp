@@ -4,8 +4,9 @@
 #include "Assert.h"
 #include <QDebug>
 
-LateNoteManager::LateNoteManager(QString root, QObject *parent):
-  Data(0), dir(root) {
+LateNoteManager::LateNoteManager(QString root, QObject *parent,
+                                 bool detached):
+  Data(0), dir(root), detached(detached) {
   QObject::setParent(parent);
   nb = 0;
   loaded = false;
@@ -24,7 +25,10 @@ void LateNoteManager::ensureLoaded() {
   QStringList flt; flt << "*.json";
   QStringList entries = dir.entryList(flt, QDir::Files);
   for (auto fn: entries) {
-    LateNoteFile *f = loadLateNoteFile(dir, fn.left(fn.indexOf(".")), this);
+    LateNoteFile *f = loadLateNoteFile(dir, fn.left(fn.indexOf(".")), this,
+                                       detached);
+    if (!f)
+      continue;
     files << f;
     LateNoteData *d = f->data();
     d->setBook(nb);
@@ -12,7 +12,9 @@
 
 class LateNoteManager: public Data {
 public:
-  LateNoteManager(QString root, QObject *parent=0);
+  LateNoteManager(QString root, QObject *parent=0, bool detached=false);
+  /* If DETACHED, notes are loaded detached (see DataFile0::attach) and
+     never saved, so that they can be read in a worker thread. */
   virtual ~LateNoteManager() {}
   LateNoteData *newNote(QPointF sp0, QPointF sp1=QPointF());
   QList<LateNoteData *> notes();
@@ -25,6 +27,7 @@ public:
 private:
   QDir dir;
   bool loaded;
+  bool detached;
   class Notebook *nb;
   QList<QPointer<LateNoteFile> > files;
 };
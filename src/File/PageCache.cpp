@@ -0,0 +1,48 @@
+// File/PageCache.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PageCache.C
+
+#include "PageCache.h"
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+namespace PageCache {
+  static char const *cacheDirName = ".cache";
+
+  bool enable(QString dir) {
+    QDir d(dir);
+    if (!d.exists(cacheDirName))
+      return d.mkdir(cacheDirName);
+    /* Earlier versions kept a copy of every page here. Reading those
+       cost more than parsing the page itself, so they are no longer
+       used. */
+    QDir c(d.absoluteFilePath(cacheDirName));
+    for (QString fn: c.entryList(QStringList() << "*.json.cache", QDir::Files))
+      c.remove(fn);
+    return true;
+  }
+
+  QString cacheFileName(QString fn) {
+    QFileInfo fi(fn);
+    QDir dir(fi.absolutePath());
+    if (!dir.exists(cacheDirName))
+      return "";
+    return dir.absoluteFilePath(QString(cacheDirName) + "/"
+                                + fi.fileName() + ".cache");
+  }
+};
@@ -0,0 +1,36 @@
+// File/PageCache.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PageCache.H
+
+#ifndef PAGECACHE_H
+
+#define PAGECACHE_H
+
+#include <QString>
+
+namespace PageCache {
+  /* A ".cache" subdirectory next to the pages, for data that can be
+     derived from them, such as the catalog snapshot. Nothing kept there
+     is authoritative; the directory can be deleted at will. */
+  bool enable(QString dir);
+  /* Creates the ".cache" subdirectory of DIR. Returns true if OK. */
+  QString cacheFileName(QString fn);
+  /* Returns the name of the cache file for FN, or an empty string if
+     caching is not enabled for the directory containing FN. */
+};
+
+#endif
@@ -28,6 +28,10 @@ void PointerSet::remove(QObject *o) {
     emit emptied();
 }
 
+bool PointerSet::contains(QObject *o) const {
+  return data.contains(o);
+}
+
 bool PointerSet::isEmpty() const {
   return data.isEmpty();
 }
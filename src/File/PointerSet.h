@@ -27,6 +27,7 @@ class PointerSet: public QObject {
   Q_OBJECT;
 public:
   void insert(QObject *);
+  bool contains(QObject *) const;
   bool isEmpty() const;
   template <class T> QList<T*> toList() const {
     QList<T*> lst;
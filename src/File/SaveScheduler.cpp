@@ -0,0 +1,116 @@
+// File/SaveScheduler.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SaveScheduler.cpp
+
+#include "SaveScheduler.h"
+#include "DataFile.h"
+#include "BackgroundSaver.h"
+#include "PointerSet.h"
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QDebug>
+
+SaveScheduler *SaveScheduler::instance() {
+  static SaveScheduler *ss = new SaveScheduler();
+  return ss;
+}
+
+SaveScheduler::SaveScheduler() {
+  dirty = new PointerSet();
+  dirty->setParent(this);
+  timer = new QTimer(this);
+  timer->setSingleShot(true);
+  connect(timer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+SaveScheduler::~SaveScheduler() {
+}
+
+void SaveScheduler::markDirty(DataFile0 *df) {
+  if (!dirty->contains(df))
+    dirty->insert(df);
+  saveSoon();
+}
+
+void SaveScheduler::markClean(DataFile0 *df) {
+  dirty->remove(df);
+}
+
+void SaveScheduler::saveSoon() {
+  if (!timer->isActive())
+    timer->start(int(DataFile0::saveDelay() * 1e3));
+}
+
+QList<DataFile0 *> SaveScheduler::startPass(bool force) {
+  timer->stop();
+  QElapsedTimer t;
+  t.start();
+  BackgroundSaver::instance()->counters(baseline.files, baseline.bytes,
+                                        baseline.writeMs);
+
+  QList<DataFile0 *> dfs = dirty->toList<DataFile0>();
+  bool blocked = !force && DataFile0::isBlocked();
+  for (DataFile0 *df: dfs) {
+    if (df->needToSave_) {
+      if (blocked)
+        df->saveWhenUnblocked();
+      else
+        df->saveInBackground();
+    }
+  }
+  emit flushing();
+
+  total.passes ++;
+  last.passes = 1;
+  last.snapshotMs = t.elapsed();
+  total.snapshotMs += last.snapshotMs;
+  return dfs;
+}
+
+void SaveScheduler::flush() {
+  startPass(false);
+}
+
+bool SaveScheduler::flushBarrier(bool force) {
+  if (!force && DataFile0::isBlocked()) {
+    startPass(false);
+    return false;
+  }
+  QList<DataFile0 *> dfs = startPass(true);
+  // Everything has been queued; now wait for it
+  bool ok = true;
+  for (DataFile0 *df: dfs)
+    ok = df->saveNow() && ok;
+  return ok;
+}
+
+SaveScheduler::Stats SaveScheduler::stats() const {
+  Stats s = total;
+  BackgroundSaver::instance()->counters(s.files, s.bytes, s.writeMs);
+  return s;
+}
+
+SaveScheduler::Stats SaveScheduler::lastFlushStats() const {
+  /* The file counts and times are those of the background writes since
+     the start of the last pass. After flushBarrier(), they are exact. */
+  Stats s = last;
+  BackgroundSaver::instance()->counters(s.files, s.bytes, s.writeMs);
+  s.files -= baseline.files;
+  s.bytes -= baseline.bytes;
+  s.writeMs -= baseline.writeMs;
+  return s;
+}
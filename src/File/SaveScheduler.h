@@ -0,0 +1,70 @@
+// File/SaveScheduler.h - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SaveScheduler.H
+
+#ifndef SAVESCHEDULER_H
+
+#define SAVESCHEDULER_H
+
+#include <QObject>
+
+class SaveScheduler: public QObject {
+  /* Keeps track of all DataFiles that need saving, and saves them all
+     in a single pass when its timer fires. Other savers, such as the
+     search index, can join the pass by connecting to flushing(). */
+  Q_OBJECT;
+public:
+  struct Stats {
+    Stats(): passes(0), files(0), bytes(0), snapshotMs(0), writeMs(0) { }
+    int passes; // number of flushes
+    int files; // number of files written
+    qint64 bytes; // total size of files written
+    qint64 snapshotMs; // time spent taking snapshots in the GUI thread
+    qint64 writeMs; // time spent writing in the background
+  };
+public:
+  static SaveScheduler *instance();
+  void markDirty(class DataFile0 *);
+  /* Called by DataFile0::saveSoon(). */
+  void markClean(class DataFile0 *);
+  /* Called by DataFile0 when it no longer needs saving. */
+  bool flushBarrier(bool force=true);
+  /* Saves everything that needs saving right now, and waits until it is
+     all on the disk. Returns true if all writes succeeded. Unless FORCE
+     is set, nothing is written while a DFBlocker is active; the files
+     are then saved when it goes away, and we return false. */
+  Stats stats() const;
+  Stats lastFlushStats() const;
+public slots:
+  void saveSoon(); // schedule a pass, even if no DataFile is dirty
+signals:
+  void flushing(); // emitted during each pass
+private slots:
+  void flush();
+private:
+  SaveScheduler();
+  virtual ~SaveScheduler();
+  QList<DataFile0 *> startPass(bool force);
+private:
+  class PointerSet *dirty;
+  class QTimer *timer;
+  Stats total;
+  Stats last;
+  Stats baseline; // background counters at start of last pass
+};
+
+#endif
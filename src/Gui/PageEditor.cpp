@@ -22,6 +22,8 @@
 #include "Toolbars.h"
 #include "SceneBank.h"
 #include "Notebook.h"
+#include "Index.h"
+#include "WordIndex.h"
 #include "Translate.h"
 #include "EntryScene.h"
 #include "Navbar.h"
@@ -49,9 +51,27 @@ PageEditor::PageEditor(SceneBank *bank): bank(bank) {
   appname += " (debug vsn)";
 #endif
   if (ttl.isEmpty())
-    setWindowTitle(appname);
+    baseTitle = appname;
   else
-    setWindowTitle(ttl.replace(QRegExp("\\s\\s*"), " ") + " - " + appname);
+    baseTitle = ttl.replace(QRegExp("\\s\\s*"), " ") + " - " + appname;
+  setWindowTitle(baseTitle);
+
+  // The search index is built in the background; show how far along it is
+  WordIndex *widx = nb->index()->words();
+  connect(widx, SIGNAL(progress(int, int)), SLOT(indexProgress(int, int)));
+  connect(widx, SIGNAL(ready()), SLOT(indexReady()));
+}
+
+void PageEditor::indexProgress(int done, int total) {
+  if (total>0 && done<total)
+    setWindowTitle(baseTitle + QString(" (indexing: %1%)")
+                   .arg(100*done/total));
+  else
+    indexReady();
+}
+
+void PageEditor::indexReady() {
+  setWindowTitle(baseTitle);
 }
 
 bool PageEditor::isHibernating() const {
@@ -42,6 +42,8 @@ signals:
 private slots:
   void nowOnEntry(int p0, int dp);
   void nowOnFrontMatter(int p0);
+  void indexProgress(int done, int total);
+  void indexReady();
 protected:
   void resizeEvent(QResizeEvent *);
   void keyPressEvent(QKeyEvent *);
@@ -55,6 +57,7 @@ private:
   class PageView *view;
   class ToolView *toolview;
   class HibernationInfo *hibernation;
+  QString baseTitle;
 };
 
 #endif
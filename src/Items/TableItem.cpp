@@ -492,6 +492,7 @@ void TableItem::representCursor(QList<TransientMarkup> &tmm) const {
 }
 
 bool TableItem::pasteMultiCell(QString txt) {
+  Data::ModBatch batch; // one mod() per Data, not one per cell
   if (cursor.hasSelection())
     cursor.deleteChar();
 
@@ -1458,6 +1458,7 @@ void TextItem::setTextWidth(double d, bool relayout) {
 
 TextCursor TextItem::insertBasicHtml(QString html, int pos, bool nonewlines,
 				     QString ref) {
+  Data::ModBatch batch; // the markups would otherwise each cascade
   HtmlParser p(html);
   TextCursor c(cursor);
   c.setPosition(pos);
@@ -45,6 +45,9 @@ TextItemDoc *TextItemDoc::create(TextData *data, QObject *parent) {
 TextItemDoc::TextItemDoc(TextData *data, QObject *parent):
   QObject(parent), d(new TextItemDocData(data)) {
   d->linestarts = d->text->lineStarts();
+  // Lets the data keep its word counts for the search index current
+  connect(this, SIGNAL(contentsChanged(int, int, int)),
+          data, SLOT(noteEdit(int, int, int)));
 }
 
 void TextItemDoc::finalizeConstructor() {
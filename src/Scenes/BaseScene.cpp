@@ -125,12 +125,13 @@ bool BaseScene::print(QPrinter *prt, QPainter *p,
   for (int k=firstSheet; k<=lastSheet; k++) {
     if (!first)
       prt->newPage();
+    SheetScene *s = sheet(k); // may create its contents on demand
     QList<QGraphicsItem *> anno = printAnnotations(k);
     for (auto a: anno)
-      sheets[k]->addItem(a);
-    sheets[k]->render(p);
+      s->addItem(a);
+    s->render(p);
     for (auto a: anno)
-      sheets[k]->removeItem(a);
+      s->removeItem(a);
     for (auto a: anno)
       delete a;
     first = false;
@@ -44,7 +44,7 @@ public:
   virtual QString pgNoToString(int) const;
   virtual void populate();
   void addItem(QGraphicsItem *it, int sheet);
-  class SheetScene *sheet(int n, bool autoextend=false);
+  virtual class SheetScene *sheet(int n, bool autoextend=false);
   class PageView *eventView() const;
   QList<class QGraphicsView *> allViews() const; // all views on this scene
   virtual bool isWritable() const;
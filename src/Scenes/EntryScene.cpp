@@ -904,10 +904,8 @@ void EntryScene::addUnlockedWarning() {
 }
 
 BlockItem const *EntryScene::findBlockByUUID(QString uuid) const {
-  for (int i=0; i<blockItems.size(); i++) 
-    if (blockItems[i]->data()->findChildByUUID(uuid))
-      return blockItems[i];
-  return 0;
+  int i = findBlock(data()->findChildByUUID(uuid));
+  return i>=0 ? blockItems[i] : 0;
 }  
 
 int EntryScene::findBlock(Data const *d0) const {
@@ -32,6 +32,10 @@ SearchResultScene::SearchResultScene(QString phrase, QString title,
   BaseScene(data, parent), phrase(phrase), ttl(title), results(results) {
   book = data->book();
   setContInMargin();
+  lastEntryPage = -1;
+  lastSheet = 0;
+  lastY = 0;
+  lastLine = 0;
 }
 
 SearchResultScene::~SearchResultScene() {
@@ -46,6 +50,11 @@ void SearchResultScene::update(QList<SearchResult> res) {
   populate();
 }
 
+void SearchResultScene::appendResults(QList<SearchResult> res) {
+  results += res;
+  layoutResults(res);
+}
+
 void SearchResultScene::populate() {
   BaseScene::populate();
   foreach (TOCItem *i, headers)
@@ -53,14 +62,20 @@ void SearchResultScene::populate() {
   headers.clear();
   sheetnos.clear();
 
-  int oldPage = -1;
+  lastEntryPage = -1;
+  lastSheet = 0;
+  lastY = style().real("margin-top");
+  lastLine = 0;
+  layoutResults(results);
+}
 
-  int sheet = 0;
+void SearchResultScene::layoutResults(QList<SearchResult> const &res) {
+  int oldPage = lastEntryPage;
+  int sheet = lastSheet;
   double y0 = style().real("margin-top");
   double y1 = style().real("page-height") - style().real("margin-bottom");
-  double y = y0;
-  QGraphicsLineItem *lastLine = 0;
-  foreach (SearchResult const &r, results) {
+  double y = lastY;
+  foreach (SearchResult const &r, res) {
     if (r.startPageOfEntry != oldPage) {
       lastLine = new QGraphicsLineItem(0, 0, style().real("page-width"), 0);
       lastLine->setPen(QPen(QBrush(style().color("toc-line-color")),
@@ -97,6 +112,9 @@ void SearchResultScene::populate() {
     }
   }
   nSheets = sheet+1;
+  lastEntryPage = oldPage;
+  lastSheet = sheet;
+  lastY = y;
 }
 
 void SearchResultScene::createContinuationItem(int i, double ytop, double ybot) {
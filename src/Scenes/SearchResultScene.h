@@ -33,6 +33,8 @@ public:
   virtual void populate();
   virtual QString title() const;
 public slots:
+  void appendResults(QList<SearchResult> results);
+  /* Lays out just the new results below those already shown. */
   void pageNumberClick(int, Qt::KeyboardModifiers, QString); // pgno, uuid
 signals:
   void pageNumberClicked(int, Qt::KeyboardModifiers,
@@ -42,6 +44,7 @@ protected:
 private:
   Style const &style() const;
   void createContinuationItem(int isheet, double ytop, double ybot);
+  void layoutResults(QList<SearchResult> const &results);
 private:
   Notebook *book;
   QString phrase;
@@ -49,6 +52,11 @@ private:
   QList<SearchResult> results;
   QList<class SearchResItem *> headers; // one for each entry with a result
   QList<int> sheetnos; // one for each header; sheet in this scene
+  // Where layoutResults() left off:
+  int lastEntryPage;
+  int lastSheet;
+  double lastY;
+  class QGraphicsLineItem *lastLine;
 };
 
 #endif
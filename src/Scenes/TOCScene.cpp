@@ -30,15 +30,28 @@ TOCScene::TOCScene(TOC *data, QObject *parent):
   BaseScene(data, parent),
   data(data) {
   setContInMargin();
+  /* Layout is done from the heights of the entries, which we measure
+     with a text item set up like a TOCItem's title. The actual TOCItems
+     are only created for sheets that are shown or printed. */
+  measurer = new QGraphicsTextItem();
+  measurer->setFont(style().font("toc-font"));
+  measurer->setTextWidth(style().real("page-width")
+                         - style().real("margin-left")
+                         - style().real("margin-right"));
+  QGraphicsTextItem line;
+  line.setFont(style().font("toc-font"));
+  line.setPlainText("0");
+  minHeight = line.boundingRect().height();
   connect(data, SIGNAL(mod()), this, SLOT(tocChanged()));
 }
 
 TOCScene::~TOCScene() {
+  delete measurer;
 }
 
 void TOCScene::populate() {
   BaseScene::populate();
-  rebuild();
+  relayout();
 }
 
 QString TOCScene::title() const {
@@ -46,68 +59,104 @@ QString TOCScene::title() const {
 }
 
 void TOCScene::tocChanged() {
-  if (data->entries().size() != items.size()) {
-    rebuild();
-  }
+  /* This is cheap: only sheets whose contents actually moved are
+     touched, so adding an entry redoes only the last sheet. */
+  relayout();
 }
 
 void TOCScene::itemChanged() {
   relayout();
 }
 
-void TOCScene::rebuild() {
-  foreach (TOCItem *i, items)
-    i->deleteLater();
-  foreach (QGraphicsLineItem *l, lines)
-    delete l;
-  items.clear();
-  lines.clear();
-  
-  foreach (TOCEntry *e, data->entries()) {
-    TOCItem *i = new TOCItem(e, this);
-    items.append(i);
-    connect(i, SIGNAL(vboxChanged()), SLOT(itemChanged()));
-    connect(i, SIGNAL(clicked(int, Qt::KeyboardModifiers)),
-	    SLOT(pageNumberClicked(int, Qt::KeyboardModifiers)));
-
-    QGraphicsLineItem *l
-      = new QGraphicsLineItem(0, 0, style().real("page-width"), 0);
-    l->setParentItem(i);
-    l->setPen(QPen(QBrush(style().color("toc-line-color")),
-		   style().real("toc-line-width")));
-    lines.append(l);
-  }
-  relayout();
+double TOCScene::entryHeight(TOCEntry const *e) {
+  QString title = e->title();
+  auto it = heights.find(e);
+  if (it!=heights.end() && it.value().title==title)
+    return it.value().h;
+  measurer->setPlainText(title);
+  Height h;
+  h.title = title;
+  h.h = qMax(measurer->boundingRect().height(), minHeight);
+  heights[e] = h;
+  return h.h;
 }
 
 void TOCScene::relayout() {
-  int sheet = 0;
   double y0 = style().real("margin-top");
-  double pw = style().real("page-width");
   double ph = style().real("page-height");
   double y1 = ph - style().real("margin-bottom");
   double y = y0;
 
+  QList< QList<Slot> > newlayout;
+  newlayout << QList<Slot>();
   page2sheet.clear();
+  QHash<TOCEntry const *, Height> oldheights;
+  oldheights.swap(heights);
   
-  for (int k=0; k<items.size(); k++) {
-    TOCItem *i = items[k];
-    double h = i->childrenBoundingRect().height();
-    if (y+h > y1) {
+  foreach (TOCEntry *e, data->entries()) {
+    if (oldheights.contains(e))
+      heights[e] = oldheights[e];
+    double h = entryHeight(e);
+    if (y+h > y1 && !newlayout.last().isEmpty()) {
       y = y0;
-      sheet++;
+      newlayout << QList<Slot>();
     }
-    page2sheet[i->data()->startPage()] = sheet;
-    if (sheet>=sheetCount())
-      setSheetCount(sheet+1);
-    sheets[sheet]->addItem(i);
-    i->setPos(QPointF(0, y));
+    Slot s;
+    s.entry = e;
+    s.y = y;
+    newlayout.last() << s;
+    page2sheet[e->startPage()] = newlayout.size() - 1;
     y += h;
-    lines[k]->setLine(0, h, pw, h);
   }
+
+  // Sheets that are no longer the same must be redone if they are shown
+  QList<int> redo;
+  foreach (int n, items.keys()) {
+    if (n>=newlayout.size() || n>=layout.size()
+        || newlayout[n]!=layout[n]) {
+      dematerialize(n);
+      if (n<newlayout.size())
+        redo << n;
+    }
+  }
+  layout = newlayout;
   
-  if (sheet+1 != sheetCount())
-    setSheetCount(sheet+1);
+  if (layout.size() != sheetCount())
+    setSheetCount(layout.size());
+
+  foreach (int n, redo)
+    materialize(n);
+}
+
+SheetScene *TOCScene::sheet(int n, bool autoextend) {
+  SheetScene *s = BaseScene::sheet(n, autoextend);
+  if (!items.contains(n) && n<layout.size())
+    materialize(n);
+  return s;
+}
+
+void TOCScene::materialize(int n) {
+  double pw = style().real("page-width");
+  QList<TOCItem *> &lst = items[n];
+  foreach (Slot const &s, layout[n]) {
+    TOCItem *i = new TOCItem(s.entry, this);
+    connect(i, SIGNAL(vboxChanged()), SLOT(itemChanged()));
+    connect(i, SIGNAL(clicked(int, Qt::KeyboardModifiers)),
+	    SLOT(pageNumberClicked(int, Qt::KeyboardModifiers)));
+    double h = entryHeight(s.entry);
+    QGraphicsLineItem *l = new QGraphicsLineItem(0, h, pw, h);
+    l->setParentItem(i);
+    l->setPen(QPen(QBrush(style().color("toc-line-color")),
+		   style().real("toc-line-width")));
+    sheets[n]->addItem(i);
+    i->setPos(QPointF(0, s.y));
+    lst << i;
+  }
+}
+
+void TOCScene::dematerialize(int n) {
+  foreach (TOCItem *i, items.take(n))
+    i->deleteLater(); // this removes it from its sheet as well
 }
 
 QString TOCScene::pgNoToString(int n) const {
@@ -22,6 +22,9 @@
 
 #include "BaseScene.h"
 #include <QMap>
+#include <QHash>
+
+class TOCEntry;
 
 class TOCScene: public BaseScene {
   Q_OBJECT;
@@ -32,6 +35,8 @@ public:
   virtual QString title() const;
   virtual QString pgNoToString(int) const;
   int sheetForPage(int) const;
+  virtual class SheetScene *sheet(int n, bool autoextend=false);
+  /* Creates the items on sheet N if they do not yet exist. */
 public slots:
   void tocChanged();
   void itemChanged();
@@ -39,12 +44,29 @@ public slots:
 private slots:
   void pageNumberClicked(int, Qt::KeyboardModifiers);
 private:
-  void rebuild();
   void relayout();
+  double entryHeight(TOCEntry const *);
+  void materialize(int sheet);
+  void dematerialize(int sheet);
+private:
+  struct Slot {
+    TOCEntry *entry;
+    double y;
+    bool operator==(Slot const &s) const {
+      return entry==s.entry && y==s.y;
+    }
+  };
+  struct Height {
+    QString title;
+    double h;
+  };
 private:
   TOC *data;
-  QList<class TOCItem *> items;
-  QList<class QGraphicsLineItem *> lines;
+  QList< QList<Slot> > layout; // one list per sheet
+  QMap<int, QList<class TOCItem *> > items; // only for materialized sheets
+  QHash<TOCEntry const *, Height> heights;
+  class QGraphicsTextItem *measurer;
+  double minHeight; // that of a single line
   QMap<int, int> page2sheet;
 };
 
@@ -15,6 +15,7 @@ QT += network svg
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets 
 greaterThan(QT_MAJOR_VERSION, 4): QT += printsupport
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
 
 DEPENDPATH +=  $$sourcedirs
 INCLUDEPATH += $$sourcedirs